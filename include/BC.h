@@ -43,6 +43,17 @@ template <class C> union BCPointer {
   operator[](size_t index) {}
 
   C *operator->() { return ptr; }
+
+  // Resolves pointer without fixup, base is start of BC buffer.
+  // Use nullptr base for buffers already fixed up by BCHeader::Fixup.
+  // Null offsets stay nullptr.
+  C *Get(const void *base) const {
+    if (!varPtr)
+      return nullptr;
+
+    return reinterpret_cast<C *>(reinterpret_cast<esIntPtr>(base) +
+                                 static_cast<esIntPtr>(varPtr));
+  }
 };
 
 struct BCHeader {
@@ -79,6 +90,10 @@ struct BCSKEL : BCBlock {
   struct BoneName {
     const char *name;
     int _pad[ES_X64 ? 2 : 3];
+
+    const char *GetName(const void *base) const {
+      return reinterpret_cast<const BCPointer<const char> *>(this)->Get(base);
+    }
   };
 
   struct BoneData {
@@ -130,10 +145,14 @@ struct BCANIM : BCBlock {
     BCArray<CubicQuatFrame> rotation;
     BCArray<CubicVector3Frame> scale;
 
-    void GetPosition(float time, Vector &out, BCANIM *hdr) const;
-    void GetRotation(float time, Vector4 &out, BCANIM *hdr) const;
-    void GetScale(float time, Vector &out, BCANIM *hdr) const;
-    void GetTransform(float time, TransformFrame &out, BCANIM *hdr) const;
+    void GetPosition(float time, Vector &out, BCANIM *hdr,
+                     const void *base = nullptr) const;
+    void GetRotation(float time, Vector4 &out, BCANIM *hdr,
+                     const void *base = nullptr) const;
+    void GetScale(float time, Vector &out, BCANIM *hdr,
+                  const void *base = nullptr) const;
+    void GetTransform(float time, TransformFrame &out, BCANIM *hdr,
+                      const void *base = nullptr) const;
   };
 
   struct AnimationData {
@@ -168,12 +187,13 @@ class BC {
     BCHeader *header;
   } data;
   bool linked;
+  bool readOnly;
   template <class _Ty0>
   // typedef wchar_t _Ty0;
   int _Load(const _Ty0 *fileName, bool suppressErrors);
 
 public:
-  BC() : data(), linked(false) {}
+  BC() : data(), linked(false), readOnly(false) {}
   ~BC();
 
   int Load(const char *fileName, bool suppressErrors = false) {
@@ -185,10 +205,21 @@ public:
     return _Load(fileName, suppressErrors);
   }
 
+  static bool IsBC(const void *file) {
+    return *static_cast<const int *>(file) == ID;
+  }
+
   int Link(void *file);
 
+  // Links file without pointer fixup, buffer is never written to.
+  // All BCPointer members must be resolved through GetBase() then.
+  int LinkReadOnly(const void *file);
+
+  const void *GetBase() const { return readOnly ? data.linked : nullptr; }
+
   template <class C> C *GetClass() {
-    BCBlock *block = reinterpret_cast<BCBlock *>(data.header->dataOffset.ptr);
+    BCBlock *block = reinterpret_cast<BCBlock *>(
+        data.header->dataOffset.Get(GetBase()));
 
     if (block->ID != C::TYPE)
       return nullptr;
@@ -0,0 +1,181 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "BC.h"
+#include <functional>
+#include <vector>
+
+class SAR;
+
+// Whole clip sampled at fixed rate, stored as structure of arrays.
+// Every channel component is a contiguous run of numFrames floats:
+// positions [track][XYZ][frame], rotations [track][XYZW][frame],
+// scales [track][XYZ][frame].
+class BCANIMBaked {
+public:
+  int numTracks, numFrames;
+  float sampleRate;
+  std::vector<float> positions, rotations, scales;
+
+  BCANIMBaked() : numTracks(0), numFrames(0), sampleRate(0.0f) {}
+
+  float *Position(int track, int component) {
+    return positions.data() + (track * 3 + component) * numFrames;
+  }
+  float *Rotation(int track, int component) {
+    return rotations.data() + (track * 4 + component) * numFrames;
+  }
+  float *Scale(int track, int component) {
+    return scales.data() + (track * 3 + component) * numFrames;
+  }
+  const float *Position(int track, int component) const {
+    return positions.data() + (track * 3 + component) * numFrames;
+  }
+  const float *Rotation(int track, int component) const {
+    return rotations.data() + (track * 4 + component) * numFrames;
+  }
+  const float *Scale(int track, int component) const {
+    return scales.data() + (track * 3 + component) * numFrames;
+  }
+};
+
+// Samples every track of animation at sampleRate (samples per second).
+// Tracks are spread across threads, components of a single key are
+// evaluated together.
+// base is BC::GetBase() of owning file.
+int BakeAnimation(const BCANIM *animation, float sampleRate, BCANIMBaked &out,
+                  const void *base = nullptr);
+
+// Row major, row vector convention, translation is stored in m[3].
+struct BCBoneMatrix {
+  Vector4 m[4];
+};
+
+// Evaluates BCANIM over BCSKEL into bone matrices.
+// Bone order and track mapping are resolved once at construction,
+// Evaluate calls do not allocate.
+class BCPoseEvaluator {
+  const BCSKEL::BoneData *skeleton;
+  const BCANIM *animation;
+  const void *base;
+  std::vector<short> boneOrder;
+  // Resolved parents, -1 for roots and bones in cyclic chains
+  std::vector<short> boneParents;
+  std::vector<short> boneTracks;
+  int numBones;
+
+public:
+  // animation can be nullptr, rest pose is evaluated then.
+  // base is BC::GetBase() of owning file, both classes must share it.
+  BCPoseEvaluator(const BCSKEL *skel, const BCANIM *anim,
+                  const void *base = nullptr);
+
+  int NumBones() const { return numBones; }
+
+  // Parent of each bone is always evaluated before the bone itself.
+  const short *GetBoneOrder() const { return boneOrder.data(); }
+
+  // local and model must hold NumBones() items, either can be nullptr.
+  void Evaluate(float time, BCBoneMatrix *local, BCBoneMatrix *model) const;
+
+  // Output arrays are laid out as [time][bone], numTimes * NumBones() items.
+  void Evaluate(const float *times, int numTimes, BCBoneMatrix *local,
+                BCBoneMatrix *model) const;
+};
+
+// Key reduced clip with linearly interpolated, 16 bit quantized curves.
+class BCANIMCompact {
+public:
+  static constexpr int NUM_COMPONENTS = 10;
+
+  // One animated component (position XYZ, rotation XYZW, scale XYZ).
+  // Single key curves are constant.
+  struct Curve {
+    int firstKey, numKeys;
+    float minValue, step;
+  };
+
+  int numTracks, numFrames;
+  float sampleRate;
+  // [track][component]
+  std::vector<Curve> curves;
+  // Sample indices at sampleRate
+  std::vector<ushort> keyFrames;
+  std::vector<ushort> keyValues;
+
+  BCANIMCompact() : numTracks(0), numFrames(0), sampleRate(0.0f) {}
+
+  float SampleCurve(int track, int component, float time) const;
+  void Sample(int track, float time, BCANIM::TransformFrame &out) const;
+  size_t GetSize() const;
+};
+
+// sourceSize is size of cubic tracks in BC file,
+// bakedSize is size of the same clip decoded by BakeAnimation.
+struct BCANIMCompressionReport {
+  size_t sourceSize, bakedSize, compactSize;
+  int numCurves, numConstantCurves, numLinearCurves, numKeys;
+
+  float Ratio() const {
+    return compactSize ? static_cast<float>(bakedSize) / compactSize : 0.0f;
+  }
+  float SourceRatio() const {
+    return compactSize ? static_cast<float>(sourceSize) / compactSize : 0.0f;
+  }
+};
+
+// Bakes animation at sampleRate, then removes keys that can be linearly
+// interpolated within tolerance. Quantization adds at most
+// (max - min) / 131070 of error on top of tolerance per curve.
+// report can be nullptr.
+int CompressAnimation(const BCANIM *animation, float sampleRate,
+                      float tolerance, BCANIMCompact &out,
+                      BCANIMCompressionReport *report = nullptr,
+                      const void *base = nullptr);
+
+// Links all BCANIM clips of SAR archive and processes them in parallel.
+// Clips are kept in archive order.
+class BCANIMBatch {
+public:
+  struct Clip {
+    int fileIndex;
+    int result;
+    BCANIM *animation;
+    const void *base;
+    BCANIMBaked baked;
+  };
+
+private:
+  std::vector<Clip> clips;
+
+public:
+  // Links every BC entry in place, or with BC::LinkReadOnly when readOnly is
+  // set. Returns number of found clips.
+  int Link(SAR &archive, bool readOnly = false);
+
+  // Runs func for every clip across threads, return value is stored into
+  // Clip::result. Returns number of clips with nonzero result.
+  int Process(const std::function<int(Clip &)> &func);
+
+  // Bakes all clips into Clip::baked.
+  int Bake(float sampleRate);
+
+  int NumClips() const { return static_cast<int>(clips.size()); }
+  Clip &GetClip(int id) { return clips[id]; }
+  const Clip &GetClip(int id) const { return clips[id]; }
+};
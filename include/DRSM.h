@@ -84,6 +84,8 @@ class DRSM {
     DRSMResources *header;
   } data;
   std::vector<char *> resources;
+  // Texture id to IDs() index, -1 for cached only textures
+  std::vector<short> highMipIDs;
 
   template <class _Ty0>
   // typedef wchar_t _Ty0;
@@ -117,6 +119,11 @@ public:
 
   const char *GetTextureName(int id) const;
 
+  // Returns stream resource index of high resolution mip, -1 if none.
+  int GetTextureStreamGroup(int id) const {
+    return highMipIDs[id] < 0 ? -1 : highMipIDs[id] + 2;
+  }
+
   int ExtractTexture(const wchar_t *outputFolder, int id,
                      TextureConversionParams params) const {
     return _ExtractTexture(outputFolder, id, params);
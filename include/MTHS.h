@@ -1,5 +1,10 @@
 #pragma once
+#include "datas/endian.hpp"
 #include "datas/supercore.hpp"
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 template <class C, bool X64> union _MTHSPointer;
 
@@ -185,4 +190,196 @@ public:
   }
   const MTHSHeader *GetShader() const { return data.header; }
   int Link(void *file);
-};
\ No newline at end of file
+};
+
+// Reads field of raw MTHS buffer, swapping big endian data on the fly.
+template <class C> C MTHSRead(const char *ptr, bool bigEndian) {
+  C value;
+  memcpy(&value, ptr, sizeof(C));
+
+  if (bigEndian)
+    FByteswapper(value);
+
+  return value;
+}
+
+// Read only reflection of vertex or pixel shader stage.
+// Works over unmodified file buffers, nothing is swapped or fixed up.
+class MTHSShaderView {
+  const char *header;
+  const char *shader;
+  bool bigEndian;
+  bool vertexShader;
+
+  int HeaderField(int id) const {
+    return MTHSRead<int>(header + id * 4, bigEndian);
+  }
+  int ShaderField(int id) const {
+    return MTHSRead<int>(shader + id * 4, bigEndian);
+  }
+  int Field(const char *item, int id) const {
+    return MTHSRead<int>(item + id * 4, bigEndian);
+  }
+  const char *Section(int headerField, int shaderField, int itemSize,
+                      int id) const {
+    return header + HeaderField(headerField) + ShaderField(shaderField) +
+           itemSize * id;
+  }
+  const char *Name(const char *item) const;
+
+public:
+  struct Sampler {
+    const char *name;
+    int type, location;
+  };
+
+  struct UniformValue {
+    const char *name;
+    int varType, arrayCount, offset, blockIndex;
+  };
+
+  struct UniformBlock {
+    const char *name;
+    int offset, size;
+  };
+
+  struct Attribute {
+    const char *name;
+    int varType, arrayCount, location;
+  };
+
+  MTHSShaderView()
+      : header(nullptr), shader(nullptr), bigEndian(false),
+        vertexShader(false) {}
+  MTHSShaderView(const char *_header, const char *_shader, bool _bigEndian,
+                 bool _vertexShader)
+      : header(_header), shader(_shader), bigEndian(_bigEndian),
+        vertexShader(_vertexShader) {}
+
+  bool IsValid() const { return shader != nullptr; }
+  bool IsBigEndian() const { return bigEndian; }
+
+  int NumRegisters() const { return ShaderField(1); }
+  int GetRegister(int id) const;
+  int ProgramSize() const { return ShaderField(2); }
+  const char *GetProgram() const;
+  int ShaderMode() const { return ShaderField(4); }
+
+  int NumSamplers() const { return ShaderField(5); }
+  Sampler GetSampler(int id) const;
+  int NumUniformVars() const { return ShaderField(7); }
+  UniformValue GetUniformValue(int id) const;
+  int NumUniformBlocks() const { return ShaderField(13); }
+  UniformBlock GetUniformBlock(int id) const;
+  int NumAttributes() const { return vertexShader ? ShaderField(15) : 0; }
+  Attribute GetAttribute(int id) const;
+};
+
+// Read only reflection over raw MTHS file (either endian).
+// Buffers already processed by MTHS on 32 bit builds are not supported.
+class MTHSView {
+  static constexpr int ID = CompileFourCC("MTHS");
+  static constexpr int IDs = CompileFourCC("SHTM");
+
+  const char *header;
+  bool bigEndian;
+
+  const char *Stage(int headerField) const;
+
+public:
+  MTHSView() : header(nullptr), bigEndian(false) {}
+
+  int Link(const void *file);
+  bool IsValid() const { return header != nullptr; }
+  int Version() const { return MTHSRead<int>(header + 4, bigEndian); }
+
+  MTHSShaderView GetVertexShader() const {
+    return MTHSShaderView(header, Stage(2), bigEndian, true);
+  }
+  MTHSShaderView GetPixelShader() const {
+    return MTHSShaderView(header, Stage(3), bigEndian, false);
+  }
+};
+
+enum MTHSEntryType {
+  MTHS_SAMPLER,
+  MTHS_UNIFORMVALUE,
+  MTHS_UNIFORMBLOCK,
+  MTHS_ATTRIBUTE,
+};
+
+// Open addressing name table of single shader stage, built once.
+// Names and entries point into shader buffer, which must outlive the index.
+class MTHSNameIndex {
+  struct Slot {
+    const char *name;
+    void *entry;
+    uint hash;
+    short type;
+    short id;
+  };
+
+  std::vector<Slot> slots;
+  uint mask;
+
+  void Reserve(int numEntries);
+  void Insert(MTHSEntryType type, int id, const char *name, void *entry);
+  const Slot *FindSlot(MTHSEntryType type, const char *name) const;
+
+public:
+  MTHSNameIndex() : mask(0) {}
+
+  void Build(MTHSHeader *hdr, MTHSPixelShaderHeader *shader);
+  void Build(MTHSHeader *hdr, MTHSVertexShaderHeader *shader);
+  void Build(const MTHSShaderView &shader);
+
+  // Returns entry index or -1.
+  int FindID(MTHSEntryType type, const char *name) const {
+    const Slot *found = FindSlot(type, name);
+    return found ? found->id : -1;
+  }
+
+  // Entry lookups are only valid for indices built from MTHSHeader.
+  MTHSSampler *FindSampler(const char *name) const {
+    const Slot *found = FindSlot(MTHS_SAMPLER, name);
+    return found ? static_cast<MTHSSampler *>(found->entry) : nullptr;
+  }
+  MTHSUniformValue *FindUniformValue(const char *name) const {
+    const Slot *found = FindSlot(MTHS_UNIFORMVALUE, name);
+    return found ? static_cast<MTHSUniformValue *>(found->entry) : nullptr;
+  }
+  MTHSUniformBlock *FindUniformBlock(const char *name) const {
+    const Slot *found = FindSlot(MTHS_UNIFORMBLOCK, name);
+    return found ? static_cast<MTHSUniformBlock *>(found->entry) : nullptr;
+  }
+  MTHSAttribute *FindAttribute(const char *name) const {
+    const Slot *found = FindSlot(MTHS_ATTRIBUTE, name);
+    return found ? static_cast<MTHSAttribute *>(found->entry) : nullptr;
+  }
+};
+
+// Content hash of registers and programs of both stages.
+// Independent of buffer endianness.
+uint64 MTHSContentHash(const MTHSView &shader);
+// Returns 0 for invalid files.
+uint64 MTHSContentHash(const void *file);
+
+// Thread safe registry of already seen shader hashes.
+class MTHSCache {
+  mutable std::mutex mutex;
+  std::unordered_map<uint64, int> items;
+
+public:
+  // Process wide instance.
+  static MTHSCache &Global();
+
+  // Returns true when hash was inserted first time, caller is then the only
+  // one responsible for processing the shader.
+  // uniqueID receives order of first insertion, can be nullptr.
+  bool Insert(uint64 hash, int *uniqueID = nullptr);
+
+  // Returns unique id of hash or -1.
+  int Find(uint64 hash) const;
+  int NumUnique() const;
+  void Clear();
+};
@@ -22,6 +22,26 @@
 #include <vector>
 
 struct MXMDHeader;
+struct MXMDCache;
+
+// lazyEndian: big endian sections are swapped on first access through
+// MXMD::Get* calls instead of during Load.
+// asyncLoad: external stream file is read on background thread while main
+// file is processed, stream groups are inflated as their data arrives.
+// lazyStreams: V3 stream file is kept open and texture groups are read and
+// inflated on first texture extraction, takes precedence over asyncLoad.
+// streamTerrain: V1 terrain geometry is paged in through MXMDTerrainStream
+// instead of reading whole stream file.
+// lodMask: bit per LOD level to keep, 0 keeps all levels. Level of mesh object
+// is GetLODID() - 1 (0 for GetLODID() of 0), level 0 is most detailed.
+// V1 meshes are always level 0.
+// Vertex and face buffers referenced only by filtered mesh objects are not
+// swapped and MXMDGeomBuffers returns nullptr for them.
+struct MXMDLoadParams {
+  bool lazyEndian : 1, asyncLoad : 1, lazyStreams : 1, streamTerrain : 1,
+      reserved : 4;
+  unsigned char lodMask;
+};
 
 class MXMDMeshObject {
 public:
@@ -43,6 +63,8 @@ public:
 
   virtual MXMDMeshObject::Ptr GetMeshObject(int id) const = 0;
   virtual int GetNumMeshObjects() const = 0;
+  // Local space bounding box, returns false if not available.
+  virtual bool GetBounds(Vector &bbMin, Vector &bbMax) const { return false; }
   virtual ~MXMDMeshGroup() {}
 };
 
@@ -71,9 +93,20 @@ public:
   virtual MXMDBone::Ptr GetBone(int id) const = 0;
   virtual int GetNumBones() const = 0;
 
+  // nullptr when skin bone does not resolve to any node.
   virtual MXMDBone::Ptr GetSkinBone(int id) const = 0;
   virtual int GetNumSkinBones() const = 0;
 
+  // Transforms of every bone into arrays of GetNumBones() items, either
+  // output can be nullptr. Absolute transforms are composed from local ones,
+  // parents first, bones in cyclic chains are treated as roots.
+  // V3 bones are parentless, their local and absolute transforms are equal.
+  virtual void GetBoneTransforms(MXMDTransformMatrix *local,
+                                 MXMDTransformMatrix *absolute) const = 0;
+  // Same as GetBoneTransforms in skin bone order, GetNumSkinBones() items.
+  virtual void GetSkinBoneTransforms(MXMDTransformMatrix *local,
+                                     MXMDTransformMatrix *absolute) const = 0;
+
   virtual const char *GetMorphName(int id) const = 0;
 
   virtual void SwapEndian() {}
@@ -129,6 +162,10 @@ public:
   virtual void Evaluate(int at, void *data) {}
   virtual MXMDVertexDescriptorType Type() const = 0;
   virtual int Size() const = 0;
+  // First element of interleaved source data in native endian, nullptr if
+  // not available.
+  virtual const char *GetRawBuffer() const { return nullptr; }
+  virtual int GetStride() const { return 0; }
   virtual ~MXMDVertexDescriptor() {}
 };
 
@@ -139,6 +176,10 @@ public:
 
   virtual DescriptorCollection GetDescriptors() const = 0;
   virtual int NumVertices() const = 0;
+  // First interleaved vertex in native endian, including attributes without
+  // descriptor, nullptr if not available.
+  virtual const char *GetRawBuffer() const { return nullptr; }
+  virtual int GetStride() const { return 0; }
   virtual ~MXMDVertexBuffer() {}
 };
 
@@ -156,11 +197,43 @@ struct MXMDVertexWeight {
   UCVector4 boneids;
 };
 
+// View over contiguous resolved vertex weights.
+struct MXMDVertexWeightSpan {
+  const MXMDVertexWeight *items;
+  int numItems;
+
+  MXMDVertexWeightSpan() : items(nullptr), numItems(0) {}
+  MXMDVertexWeightSpan(const MXMDVertexWeight *input, int size)
+      : items(input), numItems(size) {}
+
+  int Size() const { return numItems; }
+  bool Empty() const { return !numItems; }
+  const MXMDVertexWeight &operator[](int id) const { return items[id]; }
+  const MXMDVertexWeight *begin() const { return items; }
+  const MXMDVertexWeight *end() const { return items + numItems; }
+
+  // Clamped subrange
+  MXMDVertexWeightSpan Range(int first, int count) const {
+    if (first < 0 || first >= numItems || count <= 0)
+      return MXMDVertexWeightSpan();
+
+    return MXMDVertexWeightSpan(
+        items + first, count < numItems - first ? count : numItems - first);
+  }
+};
+
 class MXMDGeomVertexWeightBuffer {
 public:
   typedef std::unique_ptr<MXMDGeomVertexWeightBuffer> Ptr;
 
   virtual MXMDVertexWeight GetVertexWeight(int id) const = 0;
+  virtual int NumVertexWeights() const { return 0; }
+  // Resolves count weights starting at first into output.
+  virtual void GetVertexWeights(int first, int count,
+                                MXMDVertexWeight *output) const {
+    for (int v = 0; v < count; v++)
+      output[v] = GetVertexWeight(first + v);
+  }
   virtual ~MXMDGeomVertexWeightBuffer() {}
 };
 
@@ -180,6 +253,8 @@ class MXMDGeomBuffers {
 public:
   typedef std::unique_ptr<MXMDGeomBuffers> Ptr;
 
+  // Buffers and weight palettes outside of MXMDLoadParams::lodMask are
+  // returned as nullptr.
   virtual MXMDVertexBuffer::Ptr GetVertexBuffer(int id) const = 0;
   virtual int GetNumVertexBuffers() const = 0;
   virtual MXMDFaceBuffer::Ptr GetFaceBuffer(int id) const = 0;
@@ -196,6 +271,9 @@ class MXMDTextures {
   template <class _Ty>
   int _ExtractAllTextures(const _Ty *outputFolder,
                           TextureConversionParams params) const;
+  template <class _Ty>
+  int _ExtractTextures(const _Ty *outputFolder, const int *ids, int numIDs,
+                       TextureConversionParams params) const;
 
 public:
   typedef std::unique_ptr<MXMDTextures> Ptr;
@@ -206,6 +284,9 @@ public:
                              TextureConversionParams params) const = 0;
   virtual int ExtractTexture(const char *outputFolder, int id,
                              TextureConversionParams params) const = 0;
+  // Returns stream group that holds texture data, -1 for in file textures.
+  // ExtractAllTextures processes textures ordered by group.
+  virtual int GetTextureStreamGroup(int id) const { return -1; }
 
   int ExtractAllTextures(const wchar_t *outputFolder,
                          TextureConversionParams params) const {
@@ -215,6 +296,16 @@ public:
                          TextureConversionParams params) const {
     return _ExtractAllTextures(outputFolder, params);
   }
+  // Extracts listed textures across threads, ordered like ExtractAllTextures.
+  // Returns number of failed textures.
+  int ExtractTextures(const wchar_t *outputFolder, const int *ids, int numIDs,
+                      TextureConversionParams params) const {
+    return _ExtractTextures(outputFolder, ids, numIDs, params);
+  }
+  int ExtractTextures(const char *outputFolder, const int *ids, int numIDs,
+                      TextureConversionParams params) const {
+    return _ExtractTextures(outputFolder, ids, numIDs, params);
+  }
 
   virtual void SwapEndian(){};
   virtual ~MXMDTextures() {}
@@ -241,6 +332,9 @@ public:
   virtual int GetNumShaders() const = 0;
   virtual void *GetShaderFile(int id) const = 0;
 
+  // MTHSContentHash of shader file, 0 when invalid.
+  uint64 GetShaderHash(int id) const;
+
   virtual void SwapEndian(){};
   virtual ~MXMDShaders() {}
 };
@@ -257,11 +351,45 @@ public:
   virtual ~MXMDExternalTextures() {}
 };
 
+// Texture referenced by material.
+// containerID is -1 for textures of MXMD::GetTextures, otherwise textureID
+// points into other texture container.
+struct MXMDTextureReference {
+  int textureID, containerID;
+
+  bool operator<(const MXMDTextureReference &other) const {
+    return containerID != other.containerID ? containerID < other.containerID
+                                            : textureID < other.textureID;
+  }
+  bool operator==(const MXMDTextureReference &other) const {
+    return textureID == other.textureID && containerID == other.containerID;
+  }
+};
+
 class MXMDExternalResource {
 public:
   virtual ~MXMDExternalResource() {}
 };
 
+// Terrain geometry buffers resident in memory on demand.
+// Least recently used buffers are released once memory budget is exceeded,
+// geometry returned by MXMD::GetGeometry stays valid while its Ptr is alive.
+// Buffers in use are never released, budget may be exceeded by them.
+class MXMDTerrainStream {
+public:
+  virtual int GetNumLookups() const = 0;
+  // World space bounds of lookup entry, built from bounds of its mesh groups.
+  // Returns false if none of them provides bounds.
+  virtual bool GetLookupBounds(int id, Vector &bbMin, Vector &bbMax) const = 0;
+  // Makes geometry of lookup entry resident, returns 0 on success.
+  virtual int RequestLookup(int id) = 0;
+  // Requests every lookup intersecting sphere, returns number of them.
+  virtual int RequestArea(const Vector &center, float radius) = 0;
+  virtual void SetMemoryBudget(size_t bytes) = 0;
+  virtual size_t GetResidentSize() const = 0;
+  virtual ~MXMDTerrainStream() {}
+};
+
 class MXMD {
   static constexpr int ID_BIG = CompileFourCC("MXMD");
   static constexpr int ID = CompileFourCC("DMXM");
@@ -270,26 +398,52 @@ class MXMD {
     MXMDHeader *header;
   } data;
   MXMDExternalResource *externalResource;
+  MXMDCache *cache;
 
   template <class _Ty0>
   // typedef wchar_t _Ty0;
-  int _Load(const _Ty0 *fileName, bool suppressErrors);
+  int _Load(const _Ty0 *fileName, bool suppressErrors, MXMDLoadParams params);
+  template <class _Ty0>
+  int _ExtractMaterialTextures(const _Ty0 *outputFolder,
+                               TextureConversionParams params);
 
 public:
-  MXMD() : data(), externalResource(nullptr) {}
+  MXMD() : data(), externalResource(nullptr), cache(nullptr) {}
   ~MXMD();
 
-  int Load(const char *fileName, bool suppressErrors = false) {
-    return _Load(fileName, suppressErrors);
+  int Load(const char *fileName, bool suppressErrors = false,
+           MXMDLoadParams params = MXMDLoadParams()) {
+    return _Load(fileName, suppressErrors, params);
   }
-  int Load(const wchar_t *fileName, bool suppressErrors = false) {
-    return _Load(fileName, suppressErrors);
+  int Load(const wchar_t *fileName, bool suppressErrors = false,
+           MXMDLoadParams params = MXMDLoadParams()) {
+    return _Load(fileName, suppressErrors, params);
   }
   MXMDModel::Ptr GetModel();
   MXMDMaterials::Ptr GetMaterials();
   MXMDGeomBuffers::Ptr GetGeometry(int groupID = 0);
+  // Whole weight buffer of geometry group resolved for flags (see
+  // MXMDGeomBuffers::GetWeightsBuffer). Decoded on first call and kept until
+  // MXMD is destroyed.
+  MXMDVertexWeightSpan GetVertexWeights(int flags, int groupID = 0);
   MXMDTextures::Ptr GetTextures();
   MXMDInstances::Ptr GetInstances();
   MXMDShaders::Ptr GetShaders();
   MXMDExternalTextures::Ptr GetExternalTextures();
+  // Available when loaded with streamTerrain, owned by MXMD.
+  MXMDTerrainStream *GetTerrainStream();
+  // Unique textures used by materials, resolved through external textures
+  // when present. Sorted by container, own textures come first.
+  std::vector<MXMDTextureReference> GetMaterialTextures();
+  // Extracts own textures used by materials, references into other
+  // containers are left to caller (see GetMaterialTextures).
+  // Returns number of failed textures, -1 when there are no textures.
+  int ExtractMaterialTextures(const wchar_t *outputFolder,
+                              TextureConversionParams params) {
+    return _ExtractMaterialTextures(outputFolder, params);
+  }
+  int ExtractMaterialTextures(const char *outputFolder,
+                              TextureConversionParams params) {
+    return _ExtractMaterialTextures(outputFolder, params);
+  }
 };
@@ -0,0 +1,72 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "MXMD.h"
+
+struct MXMDInstanceHit {
+  int instance;
+  // Instance group index, see MXMDInstances::GetStartingGroup
+  int group;
+  int meshGroup;
+};
+
+// Bounding volume hierarchy over world space bounds of every instance group.
+// Instance matrices are row major, translation is stored in m[3].
+class MXMDInstanceBVH {
+public:
+  // Inner node: left child follows node, right child is at child.
+  // Leaf node: numItems items starting at child.
+  struct Node {
+    Vector bbMin;
+    int child;
+    Vector bbMax;
+    int numItems;
+  };
+
+  struct Item {
+    Vector bbMin;
+    Vector bbMax;
+    MXMDInstanceHit id;
+  };
+
+private:
+  std::vector<Node> nodes;
+  std::vector<Item> items;
+
+public:
+  // Returns 0 on success, 1 when model or instances are missing.
+  int Build(MXMD &file);
+  int Build(const MXMDModel &model, const MXMDInstances &instances);
+
+  int NumNodes() const { return static_cast<int>(nodes.size()); }
+  const Node *GetNodes() const { return nodes.data(); }
+  int NumItems() const { return static_cast<int>(items.size()); }
+  const Item *GetItems() const { return items.data(); }
+
+  // Query results are appended to out.
+  void QueryBox(const Vector &bbMin, const Vector &bbMax,
+                std::vector<MXMDInstanceHit> &out) const;
+  void QuerySphere(const Vector &center, float radius,
+                   std::vector<MXMDInstanceHit> &out) const;
+  // Planes point inwards, point p is inside when dot(XYZ, p) + W >= 0.
+  void QueryFrustum(const Vector4 *planes, int numPlanes,
+                    std::vector<MXMDInstanceHit> &out) const;
+  // Hits are sorted by entry distance along direction.
+  void QueryRay(const Vector &origin, const Vector &direction,
+                float maxDistance, std::vector<MXMDInstanceHit> &out) const;
+};
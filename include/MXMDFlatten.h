@@ -0,0 +1,69 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "MXMDBVH.h"
+
+// Bakes instanced map geometry into world space vertex streams.
+// Vertex buffers are decoded once per mesh group and shared by every
+// instance referencing it.
+// Mesh group IDs are used as MXMD::GetGeometry group IDs.
+class MXMDInstanceFlattener {
+public:
+  // Decoded vertex buffer of mesh group, [XYZ][vertex].
+  struct Source {
+    int meshGroup;
+    int vertexBuffer;
+    int numVertices;
+    std::vector<float> positions[3];
+    std::vector<float> normals[3];
+  };
+
+  // Output vertices of single vertex buffer of instance group.
+  struct Range {
+    MXMDInstanceHit id;
+    int source;
+    int firstVertex;
+    int numVertices;
+  };
+
+private:
+  std::vector<Source> sources;
+  std::vector<Range> ranges;
+  std::vector<MXMDTransformMatrix> transforms;
+  int numVertices;
+
+public:
+  MXMDInstanceFlattener() : numVertices(0) {}
+
+  // Plans output layout for hits (see MXMDInstanceBVH queries), or for every
+  // instance when hits is nullptr, then decodes referenced vertex buffers.
+  // Returns 0 on success, 1 when model or instances are missing.
+  int Plan(MXMD &file, const MXMDInstanceHit *hits = nullptr,
+           int numHits = 0);
+
+  int NumVertices() const { return numVertices; }
+  int NumRanges() const { return static_cast<int>(ranges.size()); }
+  const Range *GetRanges() const { return ranges.data(); }
+  int NumSources() const { return static_cast<int>(sources.size()); }
+  const Source &GetSource(int id) const { return sources[id]; }
+
+  // Outputs must hold NumVertices() items, normals can be nullptr.
+  // Normals are transformed by inverse transpose and renormalized.
+  // Ranges are spread across threads.
+  void Flatten(Vector *positions, Vector *normals) const;
+};
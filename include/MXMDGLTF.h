@@ -0,0 +1,41 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "MXMD.h"
+
+// noSkins: skeleton nodes are written without skin and joint attributes.
+// noMorphs: morph targets are not written.
+// noInstances: map instances are ignored, every mesh group gets single node.
+// noQuantization: byte normals are converted to floats instead of using
+// KHR_mesh_quantization.
+struct MXMDGLTFParams {
+  bool noSkins : 1, noMorphs : 1, noInstances : 1, noQuantization : 1,
+      reserved : 4;
+};
+
+// Writes model, geometry, skeleton, morph targets and instances into glTF 2.0
+// binary file.
+// Vertex attributes already in glTF compatible format are written straight
+// from MXMD buffers, remaining ones are converted while binary chunk is
+// written.
+// Returns 0 on success, 1 when model is missing, 2 when file cannot be
+// created.
+int ExportGLB(MXMD &file, const char *path,
+              MXMDGLTFParams params = MXMDGLTFParams());
+int ExportGLB(MXMD &file, const wchar_t *path,
+              MXMDGLTFParams params = MXMDGLTFParams());
@@ -0,0 +1,59 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "MXMD.h"
+
+// Morph targets of single vertex buffer decoded into structure of arrays.
+class MXMDMorphSet {
+public:
+  // Sparse delta stream, sorted by vertex id.
+  struct Target {
+    int nameID;
+    std::vector<int> vertexIDs;
+    // [XYZ][item]
+    std::vector<float> positions[3];
+    std::vector<float> normals[3];
+
+    int NumItems() const { return static_cast<int>(vertexIDs.size()); }
+  };
+
+private:
+  std::vector<Target> targets;
+  std::vector<Vector> basePositions;
+  std::vector<Vector> baseNormals;
+
+public:
+  // Decodes base and every delta target once. Returns 0 on success.
+  int Decode(const MXMDMorphTargets &morphs);
+
+  int NumTargets() const { return static_cast<int>(targets.size()); }
+  int NumVertices() const { return static_cast<int>(basePositions.size()); }
+  const Target &GetTarget(int id) const { return targets[id]; }
+  const Vector *GetBasePositions() const { return basePositions.data(); }
+  const Vector *GetBaseNormals() const { return baseNormals.data(); }
+
+  // Adds weighted deltas into existing positions and normals.
+  // weights must hold NumTargets() items, zero weights are skipped.
+  // Outputs must hold NumVertices() items, normals can be nullptr.
+  // Vertex ranges are spread across threads.
+  void Accumulate(const float *weights, Vector *positions,
+                  Vector *normals) const;
+
+  // Same as Accumulate, but starts from decoded base morph.
+  void Apply(const float *weights, Vector *positions, Vector *normals) const;
+};
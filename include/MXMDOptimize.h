@@ -0,0 +1,94 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "MXMD.h"
+
+// noWeld: vertices with identical attributes are kept separate.
+// noCacheOptimize: triangle order is kept, implies noOverdraw.
+// noOverdraw: triangle clusters are not sorted front to back.
+// noFetchReorder: vertices keep weld order instead of first use order.
+// buildMeshlets: triangles are split into meshlets.
+// Zero numeric values select defaults.
+struct MXMDMeshOptimizeParams {
+  bool noWeld : 1, noCacheOptimize : 1, noOverdraw : 1, noFetchReorder : 1,
+      buildMeshlets : 1, reserved : 3;
+  // Cache size used for ACMR measurement, 16 by default.
+  int cacheSize;
+  // Allowed ACMR increase of overdraw sort, 1.05 by default.
+  float overdrawThreshold;
+  // Meshlet limits, 64 vertices and 126 triangles by default.
+  int maxMeshletVertices;
+  int maxMeshletTriangles;
+};
+
+// Processed triangle list of single mesh object.
+class MXMDOptimizedMesh {
+public:
+  // Offsets into meshletVertices and meshletTriangles.
+  struct Meshlet {
+    int firstVertex, numVertices;
+    int firstTriangle, numTriangles;
+  };
+
+  int meshGroup, meshObject;
+  // Source vertex buffer index of every output vertex.
+  std::vector<int> vertexRemap;
+  // Triangle list into output vertices.
+  std::vector<int> indices;
+  std::vector<Meshlet> meshlets;
+  // Output vertex indices.
+  std::vector<int> meshletVertices;
+  // Three local meshlet vertex indices per triangle.
+  std::vector<uchar> meshletTriangles;
+  // Average cache miss ratio per triangle.
+  float acmrBefore, acmrAfter;
+
+  MXMDOptimizedMesh()
+      : meshGroup(-1), meshObject(-1), acmrBefore(0.0f), acmrAfter(0.0f) {}
+
+  int NumTriangles() const { return static_cast<int>(indices.size()) / 3; }
+  int NumVertices() const { return static_cast<int>(vertexRemap.size()); }
+};
+
+struct MXMDMeshOptimizeReport {
+  int numMeshes;
+  int numTriangles;
+  // Vertices referenced by source indices and vertices after welding.
+  int numVerticesBefore, numVerticesAfter;
+  int numMeshlets;
+  // Triangle weighted averages over all meshes.
+  float acmrBefore, acmrAfter;
+};
+
+// Runs processing stage over every mesh object of model, meshes are spread
+// across threads.
+class MXMDMeshOptimizer {
+  std::vector<MXMDOptimizedMesh> meshes;
+  MXMDMeshOptimizeReport report;
+
+public:
+  MXMDMeshOptimizer() : report() {}
+
+  // Returns 0 on success, 1 when model is missing.
+  int Process(MXMD &file,
+              MXMDMeshOptimizeParams params = MXMDMeshOptimizeParams());
+
+  int NumMeshes() const { return static_cast<int>(meshes.size()); }
+  const MXMDOptimizedMesh &GetMesh(int id) const { return meshes[id]; }
+  const MXMDMeshOptimizeReport &GetReport() const { return report; }
+};
@@ -0,0 +1,99 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "datas/supercore.hpp"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+// Library wide work-stealing scheduler, all parallel work of XenoLib runs on
+// it. Every worker owns a task deque, idle workers steal from others.
+// Threads waiting for group execute its pending tasks meanwhile, so nested
+// parallel calls do not spawn additional threads. Only tasks of waited group
+// and groups created by its tasks are executed, so waiting while holding a
+// lock never runs unrelated work, that might require the same lock.
+struct SchedulerParams {
+  // Number of threads executing tasks, including waiting thread.
+  // 0 uses std::thread::hardware_concurrency, 1 runs everything serially.
+  int numThreads;
+  // Bit per logical CPU, workers are pinned round robin to set bits.
+  // 0 leaves placement to OS. Only a hint, ignored where not supported.
+  uint64 affinityMask;
+};
+
+// Must not be called while tasks are running, workers are restarted on next
+// submitted task.
+void ConfigureScheduler(SchedulerParams params);
+SchedulerParams GetSchedulerParams();
+int SchedulerNumThreads();
+
+// Set of tasks waited for together.
+// First exception thrown by any task is rethrown by Wait.
+class SchedulerTaskGroup {
+  std::atomic<int> numPending;
+  std::mutex errorMutex;
+  std::exception_ptr error;
+  // Group of task, that created this group, nullptr outside of tasks.
+  SchedulerTaskGroup *parent;
+
+  friend class Scheduler;
+  friend class SchedulerTaskQueue;
+  // Returns true when last pending task finished.
+  bool Finish(std::exception_ptr taskError);
+  bool IsWithin(const SchedulerTaskGroup *group) const;
+  void Join();
+
+public:
+  SchedulerTaskGroup();
+  SchedulerTaskGroup(const SchedulerTaskGroup &) = delete;
+  SchedulerTaskGroup &operator=(const SchedulerTaskGroup &) = delete;
+  // Waits for remaining tasks, but never throws.
+  ~SchedulerTaskGroup();
+
+  void Run(std::function<void()> task);
+  void Wait();
+};
+
+// Runs every item of precore style queue (queue index, RetreiveItem,
+// operator bool, operator++) as separate task on copy of queue.
+template <class _Queue> void RunScheduledQueue(_Queue &queue) {
+  SchedulerTaskGroup group;
+
+  for (; queue; queue++) {
+    _Queue item(queue);
+    group.Run([item]() mutable { item.RetreiveItem(); });
+  }
+
+  group.Wait();
+}
+
+// Stores return value of every item into results[queue index].
+template <class _Queue>
+void RunScheduledQueue(_Queue &queue, typename _Queue::return_type *results) {
+  SchedulerTaskGroup group;
+
+  for (; queue; queue++) {
+    _Queue item(queue);
+    group.Run([item, results]() mutable {
+      results[item.queue] = item.RetreiveItem();
+    });
+  }
+
+  group.Wait();
+}
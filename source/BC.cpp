@@ -64,6 +64,7 @@ template <class _Ty0> int BC::_Load(const _Ty0 *fileName, bool suppressErrors) {
   data.masterBuffer = static_cast<char *>(malloc(fileSize));
   rd.ReadBuffer(data.masterBuffer, fileSize);
   data.header->Fixup();
+  readOnly = false;
 
   return 0;
 }
@@ -81,6 +82,20 @@ int BC::Link(void *file) {
 
   data.header->Fixup();
   linked = true;
+  readOnly = false;
+  return 0;
+}
+
+int BC::LinkReadOnly(const void *file) {
+  data.linked = const_cast<void *>(file);
+
+  if (data.header->magic != ID) {
+    printerror("[BC] Invalid header.");
+    return 1;
+  }
+
+  linked = true;
+  readOnly = true;
   return 0;
 }
 
@@ -110,9 +125,10 @@ ES_INLINE void BCANIM::CubicQuatFrame::Evaluate(Vector4 &out,
 }
 
 template <class T, class V>
-ES_INLINE void GetEvalValue(const T &frames, float time, BCANIM *hdr, V &out) {
-  const typename T::value_type *lastFrame = frames.data.ptr;
-  const typename T::value_type *endFrame = frames.data.ptr + frames.count - 1;
+ES_INLINE void GetEvalValue(const T &frames, float time, BCANIM *hdr, V &out,
+                            const void *base) {
+  const typename T::value_type *lastFrame = frames.data.Get(base);
+  const typename T::value_type *endFrame = lastFrame + frames.count - 1;
   float delta = 0.0f;
   float requiredFrame = time / hdr->frameTime;
 
@@ -137,23 +153,27 @@ ES_INLINE void GetEvalValue(const T &frames, float time, BCANIM *hdr, V &out) {
 }
 
 ES_INLINE void BCANIM::AnimationTrack::GetPosition(float time, Vector &out,
-                                                   BCANIM *hdr) const {
-  GetEvalValue(position, time, hdr, out);
+                                                   BCANIM *hdr,
+                                                   const void *base) const {
+  GetEvalValue(position, time, hdr, out, base);
 }
 
 ES_INLINE void BCANIM::AnimationTrack::GetRotation(float time, Vector4 &out,
-                                                   BCANIM *hdr) const {
-  GetEvalValue(rotation, time, hdr, out);
+                                                   BCANIM *hdr,
+                                                   const void *base) const {
+  GetEvalValue(rotation, time, hdr, out, base);
 }
 
 ES_INLINE void BCANIM::AnimationTrack::GetScale(float time, Vector &out,
-                                                BCANIM *hdr) const {
-  GetEvalValue(scale, time, hdr, out);
+                                                BCANIM *hdr,
+                                                const void *base) const {
+  GetEvalValue(scale, time, hdr, out, base);
 }
 
 void BCANIM::AnimationTrack::GetTransform(float time, TransformFrame &out,
-                                          BCANIM *hdr) const {
-  GetPosition(time, out.position, hdr);
-  GetRotation(time, out.rotation, hdr);
-  GetScale(time, out.scale, hdr);
+                                          BCANIM *hdr,
+                                          const void *base) const {
+  GetPosition(time, out.position, hdr, base);
+  GetRotation(time, out.rotation, hdr, base);
+  GetScale(time, out.scale, hdr, base);
 }
\ No newline at end of file
@@ -0,0 +1,694 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "BCAnimation.h"
+#include "SAR.h"
+#include "XenoLibScheduler.h"
+#include "datas/masterprinter.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <emmintrin.h>
+
+// Transposes up to 4 cubic curves into coefficient registers, so one Horner
+// step evaluates all components of a key at once.
+struct CubicKeySIMD {
+  __m128 a, b, c, d;
+
+  CubicKeySIMD(const BCANIM::CubicCurve *curves, int numCurves) {
+    a = _mm_loadu_ps(curves[0].items);
+    b = _mm_loadu_ps(curves[1].items);
+    c = _mm_loadu_ps(curves[2].items);
+    d = numCurves > 3 ? _mm_loadu_ps(curves[3].items) : _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+  }
+
+  ES_INLINE __m128 Evaluate(float delta) const {
+    const __m128 t = _mm_set1_ps(delta);
+    __m128 result = _mm_add_ps(_mm_mul_ps(a, t), b);
+    result = _mm_add_ps(_mm_mul_ps(result, t), c);
+    return _mm_add_ps(_mm_mul_ps(result, t), d);
+  }
+};
+
+template <class T>
+static void BakeChannel(const BCArray<T> &frames, const BCANIM *hdr,
+                        const void *base, float sampleRate, int numFrames,
+                        int numComponents, float *out, const float *defaults) {
+  if (!frames.count) {
+    for (int c = 0; c < numComponents; c++)
+      for (int s = 0; s < numFrames; s++)
+        out[c * numFrames + s] = defaults[c];
+
+    return;
+  }
+
+  const T *keys = frames.data.Get(base);
+  const int lastKey = frames.count - 1;
+  const float maxFrame = static_cast<float>(hdr->frameCount);
+  int currentKey = 0;
+  CubicKeySIMD key(keys->elements, numComponents);
+  alignas(16) float result[4];
+
+  for (int s = 0; s < numFrames; s++) {
+    float requiredFrame =
+        (static_cast<float>(s) / sampleRate) / hdr->frameTime;
+    float delta = 0.0f;
+
+    if (lastKey) {
+      int foundKey = currentKey;
+
+      while (foundKey < lastKey && keys[foundKey + 1].frame <= requiredFrame)
+        foundKey++;
+
+      if (foundKey != currentKey) {
+        currentKey = foundKey;
+        key = CubicKeySIMD(keys[currentKey].elements, numComponents);
+      }
+
+      if (requiredFrame > maxFrame)
+        requiredFrame = maxFrame;
+
+      delta = requiredFrame - keys[currentKey].frame;
+    }
+
+    _mm_store_ps(result, key.Evaluate(delta));
+
+    for (int c = 0; c < numComponents; c++)
+      out[c * numFrames + s] = result[c];
+  }
+}
+
+struct BakeQueue {
+  int queue;
+  int queueEnd;
+  const BCANIM *animation;
+  const void *base;
+  BCANIMBaked *baked;
+
+  typedef void return_type;
+
+  BakeQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    static const float positionDefaults[] = {0.0f, 0.0f, 0.0f};
+    static const float rotationDefaults[] = {0.0f, 0.0f, 0.0f, 1.0f};
+    static const float scaleDefaults[] = {1.0f, 1.0f, 1.0f};
+
+    const BCANIM::AnimationTrack &track =
+        animation->tracks.data.Get(base)[queue];
+    const int numFrames = baked->numFrames;
+    const float sampleRate = baked->sampleRate;
+
+    BakeChannel(track.position, animation, base, sampleRate, numFrames, 3,
+                baked->Position(queue, 0), positionDefaults);
+    BakeChannel(track.rotation, animation, base, sampleRate, numFrames, 4,
+                baked->Rotation(queue, 0), rotationDefaults);
+    BakeChannel(track.scale, animation, base, sampleRate, numFrames, 3,
+                baked->Scale(queue, 0), scaleDefaults);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+static int BakeAnimation(const BCANIM *animation, float sampleRate,
+                         BCANIMBaked &out, const void *base, bool threaded) {
+  if (!animation || sampleRate <= 0.0f || animation->frameTime <= 0.0f) {
+    printerror("[BCANIM] Invalid bake parameters.");
+    return 1;
+  }
+
+  const float duration = animation->frameCount * animation->frameTime;
+
+  out.numTracks = animation->tracks.count;
+  out.numFrames = static_cast<int>(duration * sampleRate) + 1;
+  out.sampleRate = sampleRate;
+
+  const size_t numSamples = static_cast<size_t>(out.numTracks) * out.numFrames;
+
+  out.positions.resize(numSamples * 3);
+  out.rotations.resize(numSamples * 4);
+  out.scales.resize(numSamples * 3);
+
+  BakeQueue bakeQue;
+  bakeQue.queueEnd = out.numTracks;
+  bakeQue.animation = animation;
+  bakeQue.base = base;
+  bakeQue.baked = &out;
+
+  if (threaded)
+    RunScheduledQueue(bakeQue);
+  else
+    for (; bakeQue; bakeQue++)
+      bakeQue.RetreiveItem();
+
+  return 0;
+}
+
+int BakeAnimation(const BCANIM *animation, float sampleRate, BCANIMBaked &out,
+                  const void *base) {
+  return BakeAnimation(animation, sampleRate, out, base, true);
+}
+
+template <class T>
+static __m128 EvaluateChannel(const BCArray<T> &frames, const BCANIM *hdr,
+                              const void *base, float time, int numComponents,
+                              __m128 defaults) {
+  if (!frames.count)
+    return defaults;
+
+  const T *keys = frames.data.Get(base);
+  const int lastKey = frames.count - 1;
+  float requiredFrame = time / hdr->frameTime;
+  float delta = 0.0f;
+  int foundKey = 0;
+
+  if (lastKey) {
+    int low = 0, high = lastKey;
+
+    while (low < high) {
+      const int mid = (low + high + 1) / 2;
+
+      if (keys[mid].frame <= requiredFrame)
+        low = mid;
+      else
+        high = mid - 1;
+    }
+
+    foundKey = low;
+    const float maxFrame = static_cast<float>(hdr->frameCount);
+
+    if (requiredFrame > maxFrame)
+      requiredFrame = maxFrame;
+
+    delta = requiredFrame - keys[foundKey].frame;
+  }
+
+  return CubicKeySIMD(keys[foundKey].elements, numComponents).Evaluate(delta);
+}
+
+// Builds local matrix from position, unnormalized quaternion and scale.
+static void ComposeMatrix(__m128 position, __m128 rotation, __m128 scale,
+                          __m128 *out) {
+  const __m128 sqr = _mm_mul_ps(rotation, rotation);
+  const __m128 halfSum = _mm_add_ps(sqr, _mm_shuffle_ps(sqr, sqr, 0x4E));
+  const __m128 len =
+      _mm_add_ps(halfSum, _mm_shuffle_ps(halfSum, halfSum, 0xB1));
+
+  if (_mm_cvtss_f32(len) > 0.0f)
+    rotation = _mm_div_ps(rotation, _mm_sqrt_ps(len));
+  else
+    rotation = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+  // Diagonal 1 - 2 (yy + zz, xx + zz, xx + yy)
+  const __m128 q2 = _mm_add_ps(rotation, rotation);
+  const __m128 sq2 = _mm_mul_ps(rotation, q2);
+  const __m128 diagonal = _mm_sub_ps(
+      _mm_set1_ps(1.0f),
+      _mm_add_ps(_mm_shuffle_ps(sq2, sq2, _MM_SHUFFLE(3, 0, 0, 1)),
+                 _mm_shuffle_ps(sq2, sq2, _MM_SHUFFLE(3, 1, 2, 2))));
+  // 2 (xy, xz, yz) and 2 (wz, wy, wx)
+  const __m128 a = _mm_mul_ps(_mm_shuffle_ps(rotation, rotation,
+                                             _MM_SHUFFLE(3, 1, 0, 0)),
+                              _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 2, 2, 1)));
+  const __m128 b = _mm_mul_ps(_mm_shuffle_ps(rotation, rotation,
+                                             _MM_SHUFFLE(3, 3, 3, 3)),
+                              _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 0, 1, 2)));
+  const __m128 sum = _mm_add_ps(a, b);
+  const __m128 diff = _mm_sub_ps(a, b);
+  const __m128 zero = _mm_setzero_ps();
+
+  // [d0, s0, f1, 0], [f0, d1, s2, 0], [s1, f2, d2, 0]
+  const __m128 row0 = _mm_shuffle_ps(
+      _mm_shuffle_ps(diagonal, sum, _MM_SHUFFLE(0, 0, 0, 0)),
+      _mm_shuffle_ps(diff, zero, _MM_SHUFFLE(0, 0, 1, 1)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+  const __m128 row1 = _mm_shuffle_ps(
+      _mm_shuffle_ps(diff, diagonal, _MM_SHUFFLE(1, 1, 0, 0)),
+      _mm_shuffle_ps(sum, zero, _MM_SHUFFLE(0, 0, 2, 2)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+  const __m128 row2 = _mm_shuffle_ps(
+      _mm_shuffle_ps(sum, diff, _MM_SHUFFLE(2, 2, 1, 1)),
+      _mm_shuffle_ps(diagonal, zero, _MM_SHUFFLE(0, 0, 2, 2)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+
+  out[0] = _mm_mul_ps(row0, _mm_shuffle_ps(scale, scale, 0x00));
+  out[1] = _mm_mul_ps(row1, _mm_shuffle_ps(scale, scale, 0x55));
+  out[2] = _mm_mul_ps(row2, _mm_shuffle_ps(scale, scale, 0xAA));
+  out[3] = _mm_or_ps(
+      _mm_and_ps(position, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))),
+      _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+}
+
+// out = left * right, out can alias left.
+static ES_INLINE void MultiplyMatrix(const __m128 *left, const __m128 *right,
+                                     __m128 *out) {
+  for (int r = 0; r < 4; r++) {
+    const __m128 row = left[r];
+    __m128 result =
+        _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0)), right[0]);
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0x55),
+                                           right[1]));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0xAA),
+                                           right[2]));
+    out[r] = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0xFF),
+                                           right[3]));
+  }
+}
+
+static ES_INLINE void LoadMatrix(const BCBoneMatrix &in, __m128 *out) {
+  for (int r = 0; r < 4; r++)
+    out[r] = _mm_loadu_ps(&in.m[r].X);
+}
+
+static ES_INLINE void StoreMatrix(const __m128 *in, BCBoneMatrix &out) {
+  for (int r = 0; r < 4; r++)
+    _mm_storeu_ps(&out.m[r].X, in[r]);
+}
+
+BCPoseEvaluator::BCPoseEvaluator(const BCSKEL *skel, const BCANIM *anim,
+                                 const void *_base)
+    : skeleton(skel ? skel->boneData.Get(_base) : nullptr), animation(anim),
+      base(_base), numBones(0) {
+  if (!skeleton)
+    return;
+
+  numBones = skeleton->boneLinks.count;
+
+  if (skeleton->boneTransforms.count < numBones)
+    numBones = skeleton->boneTransforms.count;
+
+  const short *parents = skeleton->boneLinks.data.Get(base);
+  std::vector<int> depths(numBones, -1);
+  boneParents.resize(numBones, -1);
+
+  for (int b = 0; b < numBones; b++) {
+    int depth = 0;
+    int current = parents[b];
+
+    while (current > -1 && current < numBones && depth <= numBones) {
+      current = parents[current];
+      depth++;
+    }
+
+    // Chains that never reach root are cyclic, such bones become roots
+    if (depth > numBones)
+      depth = 0;
+    else if (depth)
+      boneParents[b] = parents[b];
+
+    depths[b] = depth;
+  }
+
+  boneOrder.resize(numBones);
+
+  for (int b = 0; b < numBones; b++)
+    boneOrder[b] = static_cast<short>(b);
+
+  std::stable_sort(boneOrder.begin(), boneOrder.end(),
+                   [&depths](short a, short b) {
+                     return depths[a] < depths[b];
+                   });
+
+  boneTracks.resize(numBones, -1);
+
+  if (!animation)
+    return;
+
+  const BCANIM::AnimationData *animData = animation->animData.Get(base);
+  const short *boneTable =
+      animData ? animData->boneTableOffset.Get(base) : nullptr;
+  int numTracks = animation->tracks.count;
+
+  if (boneTable && animData->boneCount < numTracks)
+    numTracks = animData->boneCount;
+
+  for (int t = 0; t < numTracks; t++) {
+    const int boneID = boneTable ? boneTable[t] : t;
+
+    if (boneID > -1 && boneID < numBones)
+      boneTracks[boneID] = static_cast<short>(t);
+  }
+}
+
+void BCPoseEvaluator::Evaluate(float time, BCBoneMatrix *local,
+                               BCBoneMatrix *model) const {
+  const BCSKEL::BoneTransform *restPose =
+      skeleton ? skeleton->boneTransforms.data.Get(base) : nullptr;
+  const __m128 positionDefaults = _mm_setzero_ps();
+  const __m128 rotationDefaults = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+  const __m128 scaleDefaults = _mm_set1_ps(1.0f);
+
+  for (int o = 0; o < numBones; o++) {
+    const int b = boneOrder[o];
+    const int trackID = boneTracks[b];
+    const BCSKEL::BoneTransform &rest = restPose[b];
+    __m128 position = _mm_loadu_ps(&rest.position.X);
+    __m128 rotation = _mm_loadu_ps(&rest.rotation.X);
+    __m128 scale = _mm_loadu_ps(&rest.scale.X);
+
+    if (trackID > -1) {
+      const BCANIM::AnimationTrack &track =
+          animation->tracks.data.Get(base)[trackID];
+
+      if (track.position.count)
+        position = EvaluateChannel(track.position, animation, base, time, 3,
+                                   positionDefaults);
+
+      if (track.rotation.count)
+        rotation = EvaluateChannel(track.rotation, animation, base, time, 4,
+                                   rotationDefaults);
+
+      if (track.scale.count)
+        scale = EvaluateChannel(track.scale, animation, base, time, 3,
+                                scaleDefaults);
+    }
+
+    __m128 localMatrix[4];
+    ComposeMatrix(position, rotation, scale, localMatrix);
+
+    if (local)
+      StoreMatrix(localMatrix, local[b]);
+
+    if (!model)
+      continue;
+
+    const int parentID = boneParents[b];
+
+    if (parentID > -1) {
+      __m128 parentMatrix[4];
+      LoadMatrix(model[parentID], parentMatrix);
+      MultiplyMatrix(localMatrix, parentMatrix, localMatrix);
+    }
+
+    StoreMatrix(localMatrix, model[b]);
+  }
+}
+
+void BCPoseEvaluator::Evaluate(const float *times, int numTimes,
+                               BCBoneMatrix *local,
+                               BCBoneMatrix *model) const {
+  for (int t = 0; t < numTimes; t++)
+    Evaluate(times[t], local ? local + t * numBones : nullptr,
+             model ? model + t * numBones : nullptr);
+}
+
+// Greedily extends linear segments while every skipped sample stays within
+// tolerance, emits sample index of each kept key.
+static void ReduceCurve(const float *samples, int numSamples, float tolerance,
+                        std::vector<int> &keys) {
+  keys.clear();
+  keys.push_back(0);
+
+  int start = 0;
+
+  while (start < numSamples - 1) {
+    const float startValue = samples[start];
+    // Cone of slopes keeping every skipped sample within tolerance
+    float minSlope = -FLT_MAX, maxSlope = FLT_MAX;
+    int end = start + 1;
+
+    for (int next = end; next < numSamples; next++) {
+      const float distance = static_cast<float>(next - start);
+      const float offset = samples[next] - startValue;
+      const float slope = offset / distance;
+
+      if (slope < minSlope || slope > maxSlope)
+        break;
+
+      end = next;
+      minSlope = std::max(minSlope, (offset - tolerance) / distance);
+      maxSlope = std::min(maxSlope, (offset + tolerance) / distance);
+    }
+
+    keys.push_back(end);
+    start = end;
+  }
+}
+
+int CompressAnimation(const BCANIM *animation, float sampleRate,
+                      float tolerance, BCANIMCompact &out,
+                      BCANIMCompressionReport *report, const void *base) {
+  BCANIMBaked baked;
+  const int bakeResult = BakeAnimation(animation, sampleRate, baked, base);
+
+  if (bakeResult)
+    return bakeResult;
+
+  if (baked.numFrames > USHRT_MAX + 1) {
+    printerror("[BCANIM] Too many frames for compact clip: ",
+               << baked.numFrames);
+    return 2;
+  }
+
+  BCANIMCompressionReport rep = {};
+  rep.sourceSize = sizeof(BCANIM::AnimationTrack) * baked.numTracks;
+
+  const BCANIM::AnimationTrack *tracks = animation->tracks.data.Get(base);
+
+  for (int t = 0; t < baked.numTracks; t++)
+    rep.sourceSize +=
+        sizeof(BCANIM::CubicVector3Frame) *
+            (tracks[t].position.count + tracks[t].scale.count) +
+        sizeof(BCANIM::CubicQuatFrame) * tracks[t].rotation.count;
+
+  out.numTracks = baked.numTracks;
+  out.numFrames = baked.numFrames;
+  out.sampleRate = sampleRate;
+  out.curves.resize(out.numTracks * BCANIMCompact::NUM_COMPONENTS);
+  out.keyFrames.clear();
+  out.keyValues.clear();
+
+  std::vector<int> keys;
+
+  for (int t = 0; t < baked.numTracks; t++)
+    for (int c = 0; c < BCANIMCompact::NUM_COMPONENTS; c++) {
+      const float *samples =
+          c < 3 ? baked.Position(t, c)
+                : c < 7 ? baked.Rotation(t, c - 3) : baked.Scale(t, c - 7);
+      const std::pair<const float *, const float *> minMax =
+          std::minmax_element(samples, samples + baked.numFrames);
+      BCANIMCompact::Curve &curve =
+          out.curves[t * BCANIMCompact::NUM_COMPONENTS + c];
+      const float range = *minMax.second - *minMax.first;
+
+      curve.firstKey = static_cast<int>(out.keyFrames.size());
+      curve.minValue = *minMax.first;
+
+      if (range <= tolerance) {
+        curve.minValue += range * 0.5f;
+        curve.step = 0.0f;
+        curve.numKeys = 1;
+        out.keyFrames.push_back(0);
+        out.keyValues.push_back(0);
+        rep.numConstantCurves++;
+        continue;
+      }
+
+      ReduceCurve(samples, baked.numFrames, tolerance, keys);
+
+      curve.step = range / USHRT_MAX;
+      curve.numKeys = static_cast<int>(keys.size());
+
+      if (curve.numKeys == 2)
+        rep.numLinearCurves++;
+
+      for (int k : keys) {
+        const float normalized = (samples[k] - curve.minValue) / range;
+        out.keyFrames.push_back(static_cast<ushort>(k));
+        out.keyValues.push_back(
+            static_cast<ushort>(normalized * USHRT_MAX + 0.5f));
+      }
+    }
+
+  rep.numCurves = static_cast<int>(out.curves.size());
+  rep.numKeys = static_cast<int>(out.keyFrames.size());
+  rep.bakedSize = sizeof(float) * (baked.positions.size() +
+                                   baked.rotations.size() + baked.scales.size());
+  rep.compactSize = out.GetSize();
+
+  if (report)
+    *report = rep;
+
+  return 0;
+}
+
+float BCANIMCompact::SampleCurve(int track, int component, float time) const {
+  const Curve &curve = curves[track * NUM_COMPONENTS + component];
+  const ushort *frames = keyFrames.data() + curve.firstKey;
+  const ushort *values = keyValues.data() + curve.firstKey;
+
+  if (curve.numKeys == 1)
+    return curve.minValue + values[0] * curve.step;
+
+  float frame = time * sampleRate;
+  const float lastFrame = static_cast<float>(frames[curve.numKeys - 1]);
+
+  if (frame < 0.0f)
+    frame = 0.0f;
+  else if (frame > lastFrame)
+    frame = lastFrame;
+
+  const ushort *found =
+      std::upper_bound(frames, frames + curve.numKeys - 1,
+                       static_cast<ushort>(frame));
+  const int nextKey = static_cast<int>(found - frames);
+  const int prevKey = nextKey - 1;
+  const float prevFrame = frames[prevKey];
+  const float delta = (frame - prevFrame) / (frames[nextKey] - prevFrame);
+  const float value = values[prevKey] + (values[nextKey] - values[prevKey]) *
+                                            delta;
+
+  return curve.minValue + value * curve.step;
+}
+
+void BCANIMCompact::Sample(int track, float time,
+                           BCANIM::TransformFrame &out) const {
+  for (int c = 0; c < 3; c++)
+    out.position[c] = SampleCurve(track, c, time);
+
+  for (int c = 0; c < 4; c++)
+    out.rotation[c] = SampleCurve(track, c + 3, time);
+
+  // Linearly interpolated quaternion is not unit length
+  float rotationLength = 0.0f;
+
+  for (int c = 0; c < 4; c++)
+    rotationLength += out.rotation[c] * out.rotation[c];
+
+  if (rotationLength > 0.0f) {
+    rotationLength = 1.0f / std::sqrt(rotationLength);
+
+    for (int c = 0; c < 4; c++)
+      out.rotation[c] *= rotationLength;
+  }
+
+  for (int c = 0; c < 3; c++)
+    out.scale[c] = SampleCurve(track, c + 7, time);
+}
+
+size_t BCANIMCompact::GetSize() const {
+  return sizeof(Curve) * curves.size() +
+         sizeof(ushort) * (keyFrames.size() + keyValues.size());
+}
+
+struct BatchLinkQueue {
+  int queue;
+  int queueEnd;
+  SAR *archive;
+  bool readOnly;
+  std::vector<BCANIMBatch::Clip> *clips;
+
+  typedef void return_type;
+
+  BatchLinkQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    BCANIMBatch::Clip &clip = clips->at(queue);
+    void *file = archive->GetFile(queue);
+
+    clip.fileIndex = queue;
+    clip.animation = nullptr;
+    clip.base = nullptr;
+
+    if (archive->GetFileSize(queue) < static_cast<int>(sizeof(BCHeader)) ||
+        !BC::IsBC(file))
+      return;
+
+    BC bcFile;
+
+    if (readOnly ? bcFile.LinkReadOnly(file) : bcFile.Link(file))
+      return;
+
+    clip.base = bcFile.GetBase();
+    clip.animation = bcFile.GetClass<BCANIM>();
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+struct BatchProcessQueue {
+  int queue;
+  int queueEnd;
+  std::vector<BCANIMBatch::Clip> *clips;
+  const std::function<int(BCANIMBatch::Clip &)> *func;
+
+  typedef void return_type;
+
+  BatchProcessQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    BCANIMBatch::Clip &clip = clips->at(queue);
+    clip.result = (*func)(clip);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+int BCANIMBatch::Link(SAR &archive, bool readOnly) {
+  std::vector<Clip> files(archive.NumFiles());
+
+  BatchLinkQueue linkQue;
+  linkQue.queueEnd = archive.NumFiles();
+  linkQue.archive = &archive;
+  linkQue.readOnly = readOnly;
+  linkQue.clips = &files;
+
+  RunScheduledQueue(linkQue);
+
+  clips.clear();
+
+  for (auto &f : files)
+    if (f.animation) {
+      f.result = 0;
+      clips.push_back(std::move(f));
+    }
+
+  return NumClips();
+}
+
+int BCANIMBatch::Process(const std::function<int(Clip &)> &func) {
+  BatchProcessQueue processQue;
+  processQue.queueEnd = NumClips();
+  processQue.clips = &clips;
+  processQue.func = &func;
+
+  RunScheduledQueue(processQue);
+
+  int numFailed = 0;
+
+  for (auto &c : clips)
+    if (c.result)
+      numFailed++;
+
+  return numFailed;
+}
+
+int BCANIMBatch::Bake(float sampleRate) {
+  // Clips are already spread across threads, tracks are baked serially.
+  return Process([sampleRate](Clip &clip) {
+    return BakeAnimation(clip.animation, sampleRate, clip.baked, clip.base,
+                         false);
+  });
+}
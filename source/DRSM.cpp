@@ -16,7 +16,7 @@
 */
 
 #include "DRSM.h"
-#include "datas/MultiThread.hpp"
+#include "XenoLibScheduler.h"
 #include "datas/binreader.hpp"
 #include "datas/masterprinter.hpp"
 #include "zlib.h"
@@ -81,9 +81,19 @@ int DRSM::_Load(const _Ty0 *fileName, bool suppressErrors) {
   resources.resize(resQue.queueEnd);
   resQue.resources = &resources;
 
-  RunThreadedQueue(resQue);
+  RunScheduledQueue(resQue);
 
   free(resBuffer);
+
+  const int numTextures = GetNumTextures();
+  const short *highIDs = data.header->IDs();
+  highMipIDs.assign(numTextures, -1);
+
+  // First occurrence wins
+  for (int i = data.header->IDTableCount - 1; i > -1; i--)
+    if (highIDs[i] > -1 && highIDs[i] < numTextures)
+      highMipIDs[highIDs[i]] = i;
+
   return 0;
 }
 
@@ -109,15 +119,7 @@ int DRSM::_ExtractTexture(const _Ty0 *outputFolder, int id,
   DRSMTextureItem *cTex = data.header->TextureTable()->Textures() + id;
   const char *textureName = data.header->TextureTable()->TextureName(cTex);
 
-  short *highIDs = data.header->IDs();
-  int highMipID = -1;
-
-  for (int i = 0; i < data.header->IDTableCount; i++)
-    if (highIDs[i] == id) {
-      highMipID = i;
-      break;
-    }
-
+  const int highMipID = highMipIDs[id];
   DRSMResourceItem *resItems = data.header->ResourceItems();
   const UniString<_Ty0> outputName =
       outputFolder + esStringConvert<_Ty0>(textureName);
@@ -149,4 +149,276 @@ ES_INLINE void MTHSAttribute::SwapEndian(MTHSHeader *hdr) {
   _ArraySwap<int>(*this);
 
   name.Fixup(hdr->_GetNames());
-}
\ No newline at end of file
+}
+
+static_assert(sizeof(MTHSSampler) == 12, "MTHSSampler layout mismatch");
+static_assert(sizeof(MTHSUniformValue) == 20,
+              "MTHSUniformValue layout mismatch");
+static_assert(sizeof(MTHSUniformBlock) == 12,
+              "MTHSUniformBlock layout mismatch");
+static_assert(sizeof(MTHSAttribute) == 16, "MTHSAttribute layout mismatch");
+
+int MTHSView::Link(const void *file) {
+  const char *buffer = static_cast<const char *>(file);
+  const int magic = MTHSRead<int>(buffer, false);
+
+  if (magic == ID)
+    bigEndian = true;
+  else if (magic == IDs)
+    bigEndian = false;
+  else {
+    printerror("[MTHS] Invalid header.");
+    return 1;
+  }
+
+  header = buffer;
+  return 0;
+}
+
+const char *MTHSView::Stage(int headerField) const {
+  const int offset = MTHSRead<int>(header + headerField * 4, bigEndian);
+  return offset ? header + offset : nullptr;
+}
+
+const char *MTHSShaderView::Name(const char *item) const {
+  return header + HeaderField(10) + Field(item, 0);
+}
+
+int MTHSShaderView::GetRegister(int id) const {
+  return MTHSRead<int>(Section(9, 0, 4, id), bigEndian);
+}
+
+const char *MTHSShaderView::GetProgram() const {
+  return header + HeaderField(11) + ShaderField(3);
+}
+
+MTHSShaderView::Sampler MTHSShaderView::GetSampler(int id) const {
+  const char *item = Section(5, 6, 12, id);
+  Sampler retVal = {Name(item), Field(item, 1), Field(item, 2)};
+  return retVal;
+}
+
+MTHSShaderView::UniformValue MTHSShaderView::GetUniformValue(int id) const {
+  const char *item = Section(6, 8, 20, id);
+  UniformValue retVal = {Name(item), Field(item, 1), Field(item, 2),
+                         Field(item, 3), Field(item, 4)};
+  return retVal;
+}
+
+MTHSShaderView::UniformBlock MTHSShaderView::GetUniformBlock(int id) const {
+  const char *item = Section(8, 14, 12, id);
+  UniformBlock retVal = {Name(item), Field(item, 1), Field(item, 2)};
+  return retVal;
+}
+
+MTHSShaderView::Attribute MTHSShaderView::GetAttribute(int id) const {
+  const char *item = Section(7, 16, 16, id);
+  Attribute retVal = {Name(item), Field(item, 1), Field(item, 2),
+                      Field(item, 3)};
+  return retVal;
+}
+
+static uint MTHSHashName(MTHSEntryType type, const char *name) {
+  uint hash = 2166136261u ^ static_cast<uint>(type);
+
+  for (; *name; name++) {
+    hash ^= static_cast<uchar>(*name);
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+void MTHSNameIndex::Reserve(int numEntries) {
+  uint capacity = 4;
+
+  while (capacity < static_cast<uint>(numEntries) * 2)
+    capacity <<= 1;
+
+  const Slot emptySlot = {};
+  slots.assign(capacity, emptySlot);
+  mask = capacity - 1;
+}
+
+void MTHSNameIndex::Insert(MTHSEntryType type, int id, const char *name,
+                           void *entry) {
+  const uint hash = MTHSHashName(type, name);
+  uint index = hash & mask;
+
+  while (slots[index].name)
+    index = (index + 1) & mask;
+
+  Slot &slot = slots[index];
+  slot.name = name;
+  slot.entry = entry;
+  slot.hash = hash;
+  slot.type = static_cast<short>(type);
+  slot.id = static_cast<short>(id);
+}
+
+const MTHSNameIndex::Slot *MTHSNameIndex::FindSlot(MTHSEntryType type,
+                                                   const char *name) const {
+  if (slots.empty())
+    return nullptr;
+
+  const uint hash = MTHSHashName(type, name);
+
+  for (uint index = hash & mask; slots[index].name;
+       index = (index + 1) & mask) {
+    const Slot &slot = slots[index];
+
+    if (slot.hash == hash && slot.type == type && !strcmp(slot.name, name))
+      return &slot;
+  }
+
+  return nullptr;
+}
+
+void MTHSNameIndex::Build(MTHSHeader *hdr, MTHSPixelShaderHeader *shader) {
+  Reserve(shader->NumSamplers() + shader->NumUniformVars() +
+          shader->NumUniformBlocks());
+
+  MTHSSampler *sampl = shader->GetSamplers(hdr);
+
+  for (int s = 0; s < shader->NumSamplers(); s++)
+    Insert(MTHS_SAMPLER, s, sampl[s].Getname(hdr), sampl + s);
+
+  MTHSUniformValue *vars = shader->GetUniformValues(hdr);
+
+  for (int v = 0; v < shader->NumUniformVars(); v++)
+    Insert(MTHS_UNIFORMVALUE, v, vars[v].Getname(hdr), vars + v);
+
+  MTHSUniformBlock *blocks = shader->GetUniformBlocks(hdr);
+
+  for (int b = 0; b < shader->NumUniformBlocks(); b++)
+    Insert(MTHS_UNIFORMBLOCK, b, blocks[b].Getname(hdr), blocks + b);
+}
+
+void MTHSNameIndex::Build(MTHSHeader *hdr, MTHSVertexShaderHeader *shader) {
+  Reserve(shader->NumSamplers() + shader->NumUniformVars() +
+          shader->NumUniformBlocks() + shader->NumAttributes());
+
+  MTHSSampler *sampl = shader->GetSamplers(hdr);
+
+  for (int s = 0; s < shader->NumSamplers(); s++)
+    Insert(MTHS_SAMPLER, s, sampl[s].Getname(hdr), sampl + s);
+
+  MTHSUniformValue *vars = shader->GetUniformValues(hdr);
+
+  for (int v = 0; v < shader->NumUniformVars(); v++)
+    Insert(MTHS_UNIFORMVALUE, v, vars[v].Getname(hdr), vars + v);
+
+  MTHSUniformBlock *blocks = shader->GetUniformBlocks(hdr);
+
+  for (int b = 0; b < shader->NumUniformBlocks(); b++)
+    Insert(MTHS_UNIFORMBLOCK, b, blocks[b].Getname(hdr), blocks + b);
+
+  MTHSAttribute *attr = shader->GetAttributes(hdr);
+
+  for (int a = 0; a < shader->NumAttributes(); a++)
+    Insert(MTHS_ATTRIBUTE, a, attr[a].Getname(hdr), attr + a);
+}
+
+void MTHSNameIndex::Build(const MTHSShaderView &shader) {
+  Reserve(shader.NumSamplers() + shader.NumUniformVars() +
+          shader.NumUniformBlocks() + shader.NumAttributes());
+
+  for (int s = 0; s < shader.NumSamplers(); s++)
+    Insert(MTHS_SAMPLER, s, shader.GetSampler(s).name, nullptr);
+
+  for (int v = 0; v < shader.NumUniformVars(); v++)
+    Insert(MTHS_UNIFORMVALUE, v, shader.GetUniformValue(v).name, nullptr);
+
+  for (int b = 0; b < shader.NumUniformBlocks(); b++)
+    Insert(MTHS_UNIFORMBLOCK, b, shader.GetUniformBlock(b).name, nullptr);
+
+  for (int a = 0; a < shader.NumAttributes(); a++)
+    Insert(MTHS_ATTRIBUTE, a, shader.GetAttribute(a).name, nullptr);
+}
+
+// MurmurHash64A step
+static ES_INLINE uint64 MTHSHashMix(uint64 hash, uint64 value) {
+  const uint64 m = 0xc6a4a7935bd1e995ULL;
+  value *= m;
+  value ^= value >> 47;
+  value *= m;
+  hash ^= value;
+  return hash * m;
+}
+
+static uint64 MTHSHashBytes(uint64 hash, const char *data, int size) {
+  const int numBlocks = size / 8;
+
+  for (int b = 0; b < numBlocks; b++) {
+    uint64 value;
+    memcpy(&value, data + b * 8, 8);
+    hash = MTHSHashMix(hash, value);
+  }
+
+  uint64 tail = 0;
+  memcpy(&tail, data + numBlocks * 8, size & 7);
+  return MTHSHashMix(hash, tail ^ static_cast<uint64>(size));
+}
+
+static uint64 MTHSHashStage(uint64 hash, const MTHSShaderView &stage) {
+  if (!stage.IsValid())
+    return MTHSHashMix(hash, 0);
+
+  const int numRegisters = stage.NumRegisters();
+  hash = MTHSHashMix(hash, static_cast<uint64>(numRegisters));
+
+  for (int r = 0; r < numRegisters; r++)
+    hash = MTHSHashMix(hash, static_cast<uint>(stage.GetRegister(r)));
+
+  return MTHSHashBytes(hash, stage.GetProgram(), stage.ProgramSize());
+}
+
+uint64 MTHSContentHash(const MTHSView &shader) {
+  uint64 hash = 0x9E3779B97F4A7C15ULL;
+  hash = MTHSHashMix(hash, static_cast<uint>(shader.Version()));
+  hash = MTHSHashStage(hash, shader.GetVertexShader());
+  hash = MTHSHashStage(hash, shader.GetPixelShader());
+  hash ^= hash >> 47;
+  return hash ? hash : 1;
+}
+
+uint64 MTHSContentHash(const void *file) {
+  MTHSView view;
+
+  if (view.Link(file))
+    return 0;
+
+  return MTHSContentHash(view);
+}
+
+MTHSCache &MTHSCache::Global() {
+  static MTHSCache cache;
+  return cache;
+}
+
+bool MTHSCache::Insert(uint64 hash, int *uniqueID) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto inserted = items.insert(
+      std::make_pair(hash, static_cast<int>(items.size())));
+
+  if (uniqueID)
+    *uniqueID = inserted.first->second;
+
+  return inserted.second;
+}
+
+int MTHSCache::Find(uint64 hash) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto found = items.find(hash);
+  return found == items.end() ? -1 : found->second;
+}
+
+int MTHSCache::NumUnique() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return static_cast<int>(items.size());
+}
+
+void MTHSCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  items.clear();
+}
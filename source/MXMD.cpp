@@ -15,16 +15,24 @@
 	along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <climits>
+#include <list>
 #include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include "MXMD_V3.h"
 #include "DRSM.h"
+#include "MTHS.h"
+#include "XenoLibScheduler.h"
 #include "datas/binreader.hpp"
 #include "datas/masterprinter.hpp"
 #include "datas/macroLoop.hpp"
-#include "datas/MultiThread.hpp"
 
 class MXMDVertexDescriptor_Internal : public MXMDVertexDescriptor
 {
@@ -36,6 +44,8 @@ public:
 	virtual void SwapEndian(int count) {}
 	MXMDVertexDescriptorType Type() const { return type; }
 	int Size() const { return count; }
+	const char *GetRawBuffer() const { return buffer; }
+	int GetStride() const { return stride; }
 };
 
 template<MXMDVertexDescriptorType> class tVertexDescriptor;
@@ -210,6 +220,12 @@ public:
 
 	MXMDMeshObject::Ptr GetMeshObject(int id) const { return MXMDMeshObject::Ptr(new MXMDMeshObject_V1_Wrap(data->GetMeshes(masterBuffer) + id)); }
 	int GetNumMeshObjects() const { return data->meshesCount; }
+	bool GetBounds(Vector &bbMin, Vector &bbMax) const
+	{
+		bbMin = data->BBMin;
+		bbMax = data->BBMax;
+		return true;
+	}
 };
 
 class MXMDBone_V1_Wrap : public MXMDBone
@@ -225,12 +241,97 @@ public:
 	const MXMDTransformMatrix *GetTransform() const { return &data->transform; }
 };
 
-class MXMDModel_V1_Wrap : public MXMDModel
+// out = left * right
+static ES_INLINE void MultiplyTransform(const MXMDTransformMatrix &left, const MXMDTransformMatrix &right, MXMDTransformMatrix &out)
 {
-	MXMDModel_V1 *data;
+	__m128 rightRows[4];
+
+	for (int r = 0; r < 4; r++)
+		rightRows[r] = _mm_loadu_ps(reinterpret_cast<const float *>(&right.m[r]));
+
+	for (int r = 0; r < 4; r++)
+	{
+		const __m128 row = _mm_loadu_ps(reinterpret_cast<const float *>(&left.m[r]));
+		__m128 result = _mm_mul_ps(_mm_shuffle_ps(row, row, 0x00), rightRows[0]);
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0x55), rightRows[1]));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0xAA), rightRows[2]));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, 0xFF), rightRows[3]));
+		_mm_storeu_ps(reinterpret_cast<float *>(&out.m[r]), result);
+	}
+}
+
+static const MXMDTransformMatrix identityTransform = 
+{{
+	Vector4(1.f, 0.f, 0.f, 0.f),
+	Vector4(0.f, 1.f, 0.f, 0.f),
+	Vector4(0.f, 0.f, 1.f, 0.f),
+	Vector4(0.f, 0.f, 0.f, 1.f)
+}};
+
+struct MXMDNameHash
+{
+	size_t operator()(const char *name) const
+	{
+		// FNV-1a
+		size_t hash = 2166136261U;
+
+		while (*name)
+			hash = (hash ^ static_cast<unsigned char>(*name++)) * 16777619U;
+
+		return hash;
+	}
+};
+
+struct MXMDNameEqual
+{
+	bool operator()(const char *left, const char *right) const { return !strcmp(left, right); }
+};
+
+// Node order and skin bone remap table, built once per file.
+struct MXMDSkeleton_V1
+{
+	std::once_flag orderBuilt;
+	// Parent first
+	std::vector<int> order;
+	// Resolved parents, -1 for roots and bones in cyclic chains
+	std::vector<int> parents;
+	std::once_flag remapBuilt;
 	std::vector<MXMDBone_V1 *> remapBones;
-public:
-	MXMDModel_V1_Wrap(MXMDModel_V1 *input) : data(input)
+
+	void BuildOrder(const MXMDBone_V1 *bones, int numBones)
+	{
+		std::vector<int> depths(numBones);
+		parents.assign(numBones, -1);
+
+		for (int b = 0; b < numBones; b++)
+		{
+			int depth = 0;
+			int current = bones[b].parentID;
+
+			while (current > -1 && current < numBones && depth <= numBones)
+			{
+				current = bones[current].parentID;
+				depth++;
+			}
+
+			// Chain never reaches root, bone is cyclic
+			if (depth > numBones)
+				depth = 0;
+			else if (depth)
+				parents[b] = bones[b].parentID;
+
+			depths[b] = depth;
+		}
+
+		order.resize(numBones);
+
+		for (int b = 0; b < numBones; b++)
+			order[b] = b;
+
+		std::stable_sort(order.begin(), order.end(), [&depths](int a, int b) { return depths[a] < depths[b]; });
+	}
+
+	void BuildRemap(MXMDModel_V1 *data)
 	{
 		if (data->assemblyCount > 0xFFF || !data->nodesOffset || !data->boneListOffset)
 			return;
@@ -240,25 +341,41 @@ public:
 		if (!nameOffsets)
 			return;
 
+		MXMDBone_V1 *bones = data->GetBones();
+		char *namesBuffer = bones->GetMe();
+		std::unordered_map<const char *, MXMDBone_V1 *, MXMDNameHash, MXMDNameEqual> boneNames;
+		boneNames.reserve(data->nodesCount);
+
+		// First node of given name is used
+		for (int b = 0; b < data->nodesCount; b++)
+			boneNames.insert(std::make_pair(bones[b].GetBoneName(namesBuffer), bones + b));
+
 		remapBones.resize(data->boneNamesCount);
 
 		for (int r = 0; r < data->boneNamesCount; r++)
 		{
 			const char *bneName = reinterpret_cast<const char *>(nameOffsets) + nameOffsets[r];
+			auto found = boneNames.find(bneName);
 
-			for (int b = 0; b < data->nodesCount; b++)
-			{
-				MXMDBone_V1 *cBone = data->GetBones() + b;
-
-				if (!strcmp(cBone->GetBoneName(data->GetBones()->GetMe()), bneName))
-				{
-					remapBones[r] = cBone;
-					break;
-				}
-			}
+			if (found != boneNames.end())
+				remapBones[r] = found->second;
 		}
+	}
+};
 
+class MXMDModel_V1_Wrap : public MXMDModel
+{
+	MXMDModel_V1 *data;
+	MXMDSkeleton_V1 *skeleton;
+
+	// Built on first use, model might not be endian swapped yet at construction.
+	const std::vector<MXMDBone_V1 *> &RemapBones() const
+	{
+		std::call_once(skeleton->remapBuilt, [this]() { skeleton->BuildRemap(data); });
+		return skeleton->remapBones;
 	}
+public:
+	MXMDModel_V1_Wrap(MXMDModel_V1 *input, MXMDSkeleton_V1 *inSkeleton) : data(input), skeleton(inSkeleton) {}
 
 	MXMDMeshGroup::Ptr GetMeshGroup(int id) const { return MXMDMeshGroup::Ptr(new MXMDMeshGroup_V1_Wrap(data->GetMeshGroups() + id, data->GetMe())); }
 	int GetNumMeshGroups() const { return data->assemblyCount; }
@@ -266,8 +383,62 @@ public:
 	MXMDBone::Ptr GetBone(int id) const { return MXMDBone::Ptr(new MXMDBone_V1_Wrap(data->GetBones() + id, data->GetBones()->GetMe())); }
 	int GetNumBones() const { return data->nodesCount; }
 
-	MXMDBone::Ptr GetSkinBone(int id) const { return MXMDBone::Ptr(new MXMDBone_V1_Wrap(remapBones[id], data->GetBones()->GetMe())); }
-	int GetNumSkinBones() const { return static_cast<int>(remapBones.size()); }
+	MXMDBone::Ptr GetSkinBone(int id) const
+	{
+		MXMDBone_V1 *cBone = RemapBones()[id];
+		return cBone ? MXMDBone::Ptr(new MXMDBone_V1_Wrap(cBone, data->GetBones()->GetMe())) : nullptr;
+	}
+	int GetNumSkinBones() const { return static_cast<int>(RemapBones().size()); }
+
+	void GetBoneTransforms(MXMDTransformMatrix *local, MXMDTransformMatrix *absolute) const
+	{
+		const MXMDBone_V1 *bones = data->GetBones();
+		const int numBones = data->nodesCount;
+
+		if (local)
+			for (int b = 0; b < numBones; b++)
+				local[b] = bones[b].transform;
+
+		if (!absolute)
+			return;
+
+		std::call_once(skeleton->orderBuilt, [bones, numBones, this]() { skeleton->BuildOrder(bones, numBones); });
+
+		for (int b : skeleton->order)
+		{
+			const int parentID = skeleton->parents[b];
+
+			if (parentID > -1)
+				MultiplyTransform(bones[b].transform, absolute[parentID], absolute[b]);
+			else
+				absolute[b] = bones[b].transform;
+		}
+	}
+
+	void GetSkinBoneTransforms(MXMDTransformMatrix *local, MXMDTransformMatrix *absolute) const
+	{
+		const MXMDBone_V1 *bones = data->GetBones();
+		const std::vector<MXMDBone_V1 *> &remapBones = RemapBones();
+		const int numSkinBones = static_cast<int>(remapBones.size());
+		std::vector<MXMDTransformMatrix> nodeTransforms;
+
+		if (absolute)
+		{
+			nodeTransforms.resize(data->nodesCount);
+			GetBoneTransforms(nullptr, nodeTransforms.data());
+		}
+
+		for (int s = 0; s < numSkinBones; s++)
+		{
+			const MXMDBone_V1 *cBone = remapBones[s];
+
+			if (local)
+				local[s] = cBone ? cBone->transform : identityTransform;
+
+			if (absolute)
+				absolute[s] = cBone ? nodeTransforms[cBone - bones] : identityTransform;
+		}
+	}
 
 	const char *GetMorphName(int id) const { return nullptr; }
 
@@ -282,6 +453,8 @@ public:
 	MXMDVertexBuffer_V1_Wrap(MXMDVertexBuffer_V1 *input, char *inputBuffer) : data(input), masterBuffer(inputBuffer) {}
 
 	int NumVertices() const { return data->count; }
+	const char *GetRawBuffer() const { return data->Buffer(masterBuffer); }
+	int GetStride() const { return data->stride; }
 	DescriptorCollection GetDescriptors() const
 	{
 		MXMDVertexType *desc = data->Descriptors(masterBuffer);
@@ -321,6 +494,112 @@ public:
 	const USVector *GetBuffer() const { return data->Buffer(masterBuffer); }
 };
 
+// Wii U data conversion unit, big buffers are split into chunks of swapJobItems.
+struct MXMDSwapJob
+{
+	enum JobType
+	{
+		Indices,
+		Words,
+		Vertices
+	};
+
+	JobType type;
+	int begin;
+	int count;
+	char *buffer;
+	MXMDVertexBuffer_V1 *vertexBuffer;
+
+	void Run() const;
+};
+
+typedef std::vector<MXMDSwapJob> MXMDSwapJobs;
+
+static const int swapJobItems = 0x10000;
+
+static void AddSwapJobs(MXMDSwapJobs &jobs, MXMDSwapJob job, int numItems)
+{
+	for (int i = 0; i < numItems; i += swapJobItems)
+	{
+		job.begin = i;
+		job.count = std::min(swapJobItems, numItems - i);
+		jobs.push_back(job);
+	}
+}
+
+void MXMDSwapJob::Run() const
+{
+	switch (type)
+	{
+	case Indices:
+		_BulkSwap16(reinterpret_cast<ushort *>(buffer) + begin, count);
+		break;
+	case Words:
+		_BulkSwap32(reinterpret_cast<uint *>(buffer) + begin, count);
+		break;
+	case Vertices:
+	{
+		MXMDVertexBuffer::DescriptorCollection dColl = MXMDVertexBuffer_V1_Wrap(vertexBuffer, buffer).GetDescriptors();
+
+		for (auto &d : dColl)
+		{
+			MXMDVertexDescriptor_Internal &desc = static_cast<MXMDVertexDescriptor_Internal &>(*d);
+			desc.buffer += desc.stride * begin;
+			desc.SwapEndian(count);
+		}
+
+		break;
+	}
+	}
+}
+
+struct MXMDSwapQueue
+{
+	int queue;
+	int queueEnd;
+	const MXMDSwapJob *jobs;
+
+	typedef void return_type;
+
+	MXMDSwapQueue() : queue(0) {}
+
+	return_type RetreiveItem() { jobs[queue].Run(); }
+
+	operator bool() { return queue < queueEnd; }
+	void operator++(int) { queue++; }
+	int NumQueues() const { return queueEnd; }
+};
+
+static void RunSwapJobs(const MXMDSwapJobs &jobs)
+{
+	if (jobs.empty())
+		return;
+
+	MXMDSwapQueue swapQue;
+	swapQue.queueEnd = static_cast<int>(jobs.size());
+	swapQue.jobs = jobs.data();
+
+	RunScheduledQueue(swapQue);
+}
+
+// Returns byte size of descriptor made only of 32 bit values, 0 otherwise.
+static int WordDescriptorSize(short type)
+{
+	switch (type)
+	{
+	case MXMD_POSITION:
+	case MXMD_WEIGHT32:
+	case MXMD_NORMAL32:
+		return 12;
+	case MXMD_UV1:
+	case MXMD_UV2:
+	case MXMD_UV3:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
 class MXMDGeometryHeader_V1_Wrap : public MXMDGeomBuffers
 {
 	MXMDGeometryHeader_V1 *data;
@@ -334,6 +613,9 @@ public:
 	MXMDGeomVertexWeightBuffer::Ptr GetWeightsBuffer(int flags) const;
 	MXMDMorphTargets::Ptr GetVertexBufferMorphTargets(int vertexBufferID) const { return nullptr; }
 	void SwapEndian();
+
+	// Swaps headers, buffer data conversion is appended to jobs.
+	void CollectSwapJobs(MXMDSwapJobs &jobs);
 };
 
 class MXMDGeomVertexWeightBuffer_V1 : public MXMDGeomVertexWeightBuffer
@@ -343,21 +625,134 @@ public:
 		wtb2;
 
 	MXMDVertexWeight GetVertexWeight(int id) const;
+	int NumVertexWeights() const;
+	void GetVertexWeights(int first, int count, MXMDVertexWeight *output) const;
 };
 
+static ES_INLINE __m128 CompleteVertexWeight(__m128 weights)
+{
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	weights = _mm_and_ps(weights, xyzMask);
+
+	// W = max(1 - X - Y - Z, 0)
+	__m128 sum = _mm_add_ps(weights, _mm_shuffle_ps(weights, weights, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	const __m128 lastWeight = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.f), sum), _mm_setzero_ps());
+
+	return _mm_or_ps(weights, _mm_andnot_ps(xyzMask, lastWeight));
+}
+
+// Decodes weight and bone id streams straight from vertex buffer.
+static void DecodeVertexWeights(const MXMDVertexBuffer::DescriptorCollection &coll, MXMDVertexDescriptorType weightType,
+	MXMDVertexDescriptorType boneType, int first, int count, MXMDVertexWeight *output)
+{
+	const MXMDVertexDescriptor_Internal *weights = nullptr;
+	const MXMDVertexDescriptor_Internal *boneids = nullptr;
+
+	for (auto &d : coll)
+	{
+		const MXMDVertexDescriptor_Internal &desc = static_cast<const MXMDVertexDescriptor_Internal &>(*d);
+
+		if (desc.type == weightType)
+			weights = &desc;
+		else if (desc.type == boneType)
+			boneids = &desc;
+	}
+
+	const __m128 weight16Scale = _mm_set1_ps(1.f / USHRT_MAX);
+
+	for (int v = 0; v < count; v++)
+	{
+		MXMDVertexWeight nw = {};
+		const int at = first + v;
+
+		if (weights)
+		{
+			const char *weightData = weights->buffer + weights->stride * at;
+			__m128 cWeight;
+
+			if (weightType == MXMD_WEIGHT16)
+			{
+				const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(weightData));
+				cWeight = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+				cWeight = _mm_mul_ps(cWeight, weight16Scale);
+			}
+			else
+			{
+				const float *floats = reinterpret_cast<const float *>(weightData);
+				cWeight = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64 *>(floats));
+				cWeight = _mm_movelh_ps(cWeight, _mm_load_ss(floats + 2));
+			}
+
+			_mm_storeu_ps(reinterpret_cast<float *>(&nw.weights), CompleteVertexWeight(cWeight));
+		}
+
+		if (boneids)
+			nw.boneids = *reinterpret_cast<const UCVector4 *>(boneids->buffer + boneids->stride * at);
+
+		output[v] = nw;
+	}
+}
+
 void MXMDGeometryHeader_V1_Wrap::SwapEndian()
+{
+	MXMDSwapJobs jobs;
+	CollectSwapJobs(jobs);
+	RunSwapJobs(jobs);
+}
+
+void MXMDGeometryHeader_V1_Wrap::CollectSwapJobs(MXMDSwapJobs &jobs)
 {
 	data->SwapEndian();
 
-	const int numVBuffers = GetNumVertexBuffers();
+	char *masterBuffer = data->GetMe();
+	MXMDVertexBuffer_V1 *vBuffers = data->GetVertexBuffers();
 
-	for (int v = 0; v < numVBuffers; v++)
+	for (int v = 0; v < data->vertexBuffersCount; v++)
 	{
-		MXMDVertexBuffer::Ptr vBuff = GetVertexBuffer(v);
-		MXMDVertexBuffer::DescriptorCollection dColl = vBuff->GetDescriptors();
+		MXMDVertexBuffer_V1 &vBuff = vBuffers[v];
+		MXMDVertexType *desc = vBuff.Descriptors(masterBuffer);
+		int wordsSize = 0;
 
-		for (auto &d : dColl)
-			static_cast<MXMDVertexDescriptor_Internal &>(*d).SwapEndian(vBuff->NumVertices());
+		for (int d = 0; d < vBuff.descriptorsCount; d++)
+		{
+			const int descSize = WordDescriptorSize(desc[d].type);
+
+			if (!descSize || descSize != desc[d].size)
+			{
+				wordsSize = -1;
+				break;
+			}
+
+			wordsSize += descSize;
+		}
+
+		MXMDSwapJob job = {};
+		job.vertexBuffer = &vBuff;
+
+		if (wordsSize == vBuff.stride)
+		{
+			// Whole vertex is made of floats, swap it as one continuous stream
+			job.type = MXMDSwapJob::Words;
+			job.buffer = vBuff.Buffer(masterBuffer);
+			AddSwapJobs(jobs, job, vBuff.count * (vBuff.stride / 4));
+		}
+		else
+		{
+			job.type = MXMDSwapJob::Vertices;
+			job.buffer = masterBuffer;
+			AddSwapJobs(jobs, job, vBuff.count);
+		}
+	}
+
+	MXMDFaceBuffer_V1 *fBuffers = data->GetFaceBuffers();
+
+	for (int f = 0; f < data->faceBuffersCount; f++)
+	{
+		MXMDSwapJob job = {};
+		job.type = MXMDSwapJob::Indices;
+		job.buffer = reinterpret_cast<char *>(fBuffers[f].BufferRaw(masterBuffer));
+		AddSwapJobs(jobs, job, fBuffers[f].count);
 	}
 }
 
@@ -397,13 +792,413 @@ public:
 	}
 };
 
+// Keeps resident buffer alive as long as wrapper exists.
+class MXMDGeometryHeader_V1_Resident : public MXMDGeometryHeader_V1_Wrap
+{
+	std::shared_ptr<char> resident;
+public:
+	MXMDGeometryHeader_V1_Resident(const std::shared_ptr<char> &input) :
+		MXMDGeometryHeader_V1_Wrap(reinterpret_cast<MXMDGeometryHeader_V1 *>(input.get())), resident(input) {}
+};
+
+static const size_t terrainDefaultBudget = 0x10000000;
+
+// Terrain stream file is kept open, geometry buffers are read by offset.
+// Buffer size is resolved from its vertex and face tables, so trailing
+// stream data is never read.
+// Buffers still referenced by caller are never evicted.
+// Uncached textures are not available, buffer stays nullptr.
+class MXMDTerrainStream_V1 : public MXMDExternalResource_V1, public MXMDTerrainStream
+{
+	struct Resident
+	{
+		std::shared_ptr<char> buffer;
+		size_t size;
+		std::list<int>::iterator lruItem;
+	};
+
+	struct Bounds
+	{
+		Vector bbMin, bbMax;
+		bool valid;
+	};
+
+	std::unique_ptr<BinReader> stream;
+	std::mutex streamMutex;
+	MXMDTerrainBufferLookupHeader_V1 *lookups;
+	bool swapEndian;
+	size_t budget;
+	size_t residentSize;
+	mutable std::mutex residentMutex;
+	std::unordered_map<int, Resident> residents;
+	// Most recently used first
+	std::list<int> lru;
+	std::vector<Bounds> lookupBounds;
+
+	template<class C> bool ReadItems(size_t offset, int count, std::vector<C> &items)
+	{
+		if (count < 0 || offset + sizeof(C) * count > stream->GetSize())
+			return false;
+
+		items.resize(count);
+
+		if (!count)
+			return true;
+
+		stream->Seek(offset);
+		stream->ReadBuffer(reinterpret_cast<char *>(items.data()), sizeof(C) * count);
+
+		return true;
+	}
+
+	// Extent of geometry header, its tables and buffer data, 0 when invalid.
+	size_t BufferSize(int offset)
+	{
+		std::lock_guard<std::mutex> guard(streamMutex);
+		std::vector<MXMDGeometryHeader_V1> header;
+
+		if (offset < 0 || !ReadItems(offset, 1, header))
+			return 0;
+
+		MXMDGeometryHeader_V1 &hdr = header[0];
+
+		if (swapEndian)
+		{
+			FByteswapper(hdr.vertexBuffersOffset);
+			FByteswapper(hdr.vertexBuffersCount);
+			FByteswapper(hdr.faceBuffersOffset);
+			FByteswapper(hdr.faceBuffersCount);
+		}
+
+		std::vector<MXMDVertexBuffer_V1> vBuffers;
+		std::vector<MXMDFaceBuffer_V1> fBuffers;
+
+		if (!ReadItems(offset + hdr.vertexBuffersOffset, hdr.vertexBuffersCount, vBuffers) ||
+			!ReadItems(offset + hdr.faceBuffersOffset, hdr.faceBuffersCount, fBuffers))
+			return 0;
+
+		size_t extent = sizeof(MXMDGeometryHeader_V1);
+		extent = std::max(extent, hdr.vertexBuffersOffset + sizeof(MXMDVertexBuffer_V1) * hdr.vertexBuffersCount);
+		extent = std::max(extent, hdr.faceBuffersOffset + sizeof(MXMDFaceBuffer_V1) * hdr.faceBuffersCount);
+
+		for (auto &v : vBuffers)
+		{
+			if (swapEndian)
+				_ArraySwap<int>(v);
+
+			extent = std::max(extent, static_cast<size_t>(v.descriptorsOffset) + sizeof(MXMDVertexType) * v.descriptorsCount);
+			extent = std::max(extent, static_cast<size_t>(v.offset) + static_cast<size_t>(v.count) * v.stride);
+		}
+
+		for (auto &f : fBuffers)
+		{
+			if (swapEndian)
+				f.SwapEndian();
+
+			extent = std::max(extent, static_cast<size_t>(f.offset) + sizeof(ushort) * f.count);
+		}
+
+		return offset + extent > stream->GetSize() ? 0 : extent;
+	}
+
+	// Releases least recently used buffers, that are not referenced elsewhere.
+	void Evict(size_t required)
+	{
+		auto it = lru.end();
+
+		while (it != lru.begin() && residentSize + required > budget)
+		{
+			--it;
+			auto found = residents.find(*it);
+
+			if (found->second.buffer.use_count() > 1)
+				continue;
+
+			residentSize -= found->second.size;
+			residents.erase(found);
+			it = lru.erase(it);
+		}
+	}
+
+	static void ExpandBounds(Bounds &bounds, const Vector &bbMin, const Vector &bbMax)
+	{
+		if (!bounds.valid)
+		{
+			bounds.bbMin = bbMin;
+			bounds.bbMax = bbMax;
+			bounds.valid = true;
+			return;
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			bounds.bbMin[c] = std::min(bounds.bbMin[c], bbMin[c]);
+			bounds.bbMax[c] = std::max(bounds.bbMax[c], bbMax[c]);
+		}
+	}
+
+	static void TransformBounds(const MXMDTransformMatrix &mtx, const Vector &inMin, const Vector &inMax, Vector &outMin, Vector &outMax)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			outMin[c] = outMax[c] = mtx.m[3][c];
+
+			for (int r = 0; r < 3; r++)
+			{
+				const float a = mtx.m[r][c] * inMin[r];
+				const float b = mtx.m[r][c] * inMax[r];
+				outMin[c] += std::min(a, b);
+				outMax[c] += std::max(a, b);
+			}
+		}
+	}
+
+public:
+	MXMDTerrainStream_V1(BinReader *input, MXMDTerrainBufferLookupHeader_V1 *inLookups, bool inSwapEndian) :
+		stream(input), lookups(inLookups), swapEndian(inSwapEndian), budget(terrainDefaultBudget), residentSize(0) {}
+
+	// Lookup bounds are union of mesh group bounds, that are mapped to lookup
+	// by group indices, in world space when groups are instanced.
+	void BuildBounds(const MXMDModel &model, const MXMDInstances *instances)
+	{
+		const int numLookups = lookups->bufferLookupCount;
+		const int numMeshGroups = std::min(model.GetNumMeshGroups(), lookups->groupIndicesCount);
+		const ushort *indices = lookups->GetGroupIndices();
+		std::vector<Bounds> groupBounds(numMeshGroups);
+		std::vector<Bounds> instancedBounds(numMeshGroups);
+
+		lookupBounds.assign(numLookups, Bounds());
+
+		for (int g = 0; g < numMeshGroups; g++)
+		{
+			MXMDMeshGroup::Ptr meshGroup = model.GetMeshGroup(g);
+			groupBounds[g].valid = meshGroup && meshGroup->GetBounds(groupBounds[g].bbMin, groupBounds[g].bbMax);
+		}
+
+		const int numInstances = instances ? instances->GetNumInstances() : 0;
+
+		for (int i = 0; i < numInstances; i++)
+		{
+			const MXMDTransformMatrix &mtx = *instances->GetTransform(i);
+			const int startingGroup = instances->GetStartingGroup(i);
+			const int endGroup = startingGroup + instances->GetNumGroups(i);
+
+			for (int g = startingGroup; g < endGroup; g++)
+			{
+				const int meshGroup = instances->GetMeshGroup(g);
+
+				if (meshGroup < 0 || meshGroup >= numMeshGroups || !groupBounds[meshGroup].valid)
+					continue;
+
+				Vector bbMin, bbMax;
+				TransformBounds(mtx, groupBounds[meshGroup].bbMin, groupBounds[meshGroup].bbMax, bbMin, bbMax);
+				ExpandBounds(instancedBounds[meshGroup], bbMin, bbMax);
+			}
+		}
+
+		for (int g = 0; g < numMeshGroups; g++)
+		{
+			const Bounds &cBounds = instancedBounds[g].valid ? instancedBounds[g] : groupBounds[g];
+			int outerIndex = indices[g];
+
+			if (outerIndex >= numLookups)
+				outerIndex -= numLookups;
+
+			if (!cBounds.valid || outerIndex < 0 || outerIndex >= numLookups)
+				continue;
+
+			ExpandBounds(lookupBounds[outerIndex], cBounds.bbMin, cBounds.bbMax);
+		}
+	}
+
+	std::shared_ptr<char> Acquire(int offset)
+	{
+		{
+			std::lock_guard<std::mutex> guard(residentMutex);
+			auto found = residents.find(offset);
+
+			if (found != residents.end())
+			{
+				lru.splice(lru.begin(), lru, found->second.lruItem);
+				return found->second.buffer;
+			}
+		}
+
+		const size_t bufferSize = BufferSize(offset);
+
+		if (!bufferSize)
+			return nullptr;
+
+		std::shared_ptr<char> buffer(static_cast<char *>(malloc(bufferSize)), free);
+
+		{
+			std::lock_guard<std::mutex> guard(streamMutex);
+			stream->Seek(offset);
+			stream->ReadBuffer(buffer.get(), bufferSize);
+		}
+
+		if (swapEndian)
+			MXMDGeometryHeader_V1_Wrap(reinterpret_cast<MXMDGeometryHeader_V1 *>(buffer.get())).SwapEndian();
+
+		std::lock_guard<std::mutex> guard(residentMutex);
+		auto found = residents.find(offset);
+
+		// Loaded by other thread meanwhile
+		if (found != residents.end())
+		{
+			lru.splice(lru.begin(), lru, found->second.lruItem);
+			return found->second.buffer;
+		}
+
+		Evict(bufferSize);
+
+		lru.push_front(offset);
+		Resident &cResident = residents[offset];
+		cResident.buffer = buffer;
+		cResident.size = bufferSize;
+		cResident.lruItem = lru.begin();
+		residentSize += bufferSize;
+
+		return buffer;
+	}
+
+	MXMDGeomBuffers::Ptr GetGeometry(int offset)
+	{
+		std::shared_ptr<char> buffer = Acquire(offset);
+
+		if (!buffer)
+			return nullptr;
+
+		return MXMDGeomBuffers::Ptr(new MXMDGeometryHeader_V1_Resident(buffer));
+	}
+
+	int GetNumLookups() const { return lookups->bufferLookupCount; }
+
+	bool GetLookupBounds(int id, Vector &bbMin, Vector &bbMax) const
+	{
+		if (id < 0 || id >= static_cast<int>(lookupBounds.size()) || !lookupBounds[id].valid)
+			return false;
+
+		bbMin = lookupBounds[id].bbMin;
+		bbMax = lookupBounds[id].bbMax;
+
+		return true;
+	}
+
+	int RequestLookup(int id)
+	{
+		if (id < 0 || id >= lookups->bufferLookupCount)
+			return 1;
+
+		MXMDTerrainBufferLookup_V1 &cLookup = lookups->GetBufferLookups()[id];
+		// Held buffers cannot be evicted by following Acquire
+		std::shared_ptr<char> buffers[2];
+
+		for (int s = 0; s < 2; s++)
+			if (!(buffers[s] = Acquire(cLookup.bufferIndex[s])))
+				return 2;
+
+		return 0;
+	}
+
+	int RequestArea(const Vector &center, float radius)
+	{
+		int numRequested = 0;
+
+		for (int l = 0; l < lookups->bufferLookupCount; l++)
+		{
+			Vector bbMin, bbMax;
+
+			if (!GetLookupBounds(l, bbMin, bbMax))
+				continue;
+
+			const float dx = center.X - std::min(std::max(center.X, bbMin.X), bbMax.X);
+			const float dy = center.Y - std::min(std::max(center.Y, bbMin.Y), bbMax.Y);
+			const float dz = center.Z - std::min(std::max(center.Z, bbMin.Z), bbMax.Z);
+
+			if (dx * dx + dy * dy + dz * dz > radius * radius)
+				continue;
+
+			if (!RequestLookup(l))
+				numRequested++;
+		}
+
+		return numRequested;
+	}
+
+	void SetMemoryBudget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> guard(residentMutex);
+		budget = bytes;
+		Evict(0);
+	}
+
+	size_t GetResidentSize() const
+	{
+		std::lock_guard<std::mutex> guard(residentMutex);
+		return residentSize;
+	}
+};
+
+struct MXMDTextureSlot
+{
+	short group;
+	short slot;
+};
+
+// Texture id to uncached group and slot within group
+typedef std::vector<MXMDTextureSlot> MXMDTextureLookup;
+
+static void BuildTextureLookup(MXMDHeader *header, MXMDTextureLookup &lookup)
+{
+	if (!header->cachedTexturesOffset)
+		return;
+
+	CASMTGroup *cached = reinterpret_cast<CASMTGroup *>(header->GetMe() + header->cachedTexturesOffset);
+	const MXMDTextureSlot invalidSlot = {-1, -1};
+	lookup.assign(cached->count, invalidSlot);
+
+	if (!header->uncachedTexturesOffset)
+		return;
+
+	CASMTHeader *uncached = reinterpret_cast<CASMTHeader *>(header->GetMe() + header->uncachedTexturesOffset);
+
+	// Last group has priority
+	for (int g = uncached->numGroups - 1; g > -1; g--)
+	{
+		short *ids = uncached->GetGroupTextureIDs(g);
+		CASMTGroup *grp = uncached->GetGroup(g);
+
+		for (int i = 0; i < grp->count; i++)
+		{
+			const short cID = ids[i];
+
+			if (cID > -1 && cID < cached->count && lookup[cID].group < 0)
+			{
+				lookup[cID].group = static_cast<short>(g);
+				lookup[cID].slot = static_cast<short>(i);
+			}
+		}
+	}
+}
+
+static const MXMDTextureSlot *FindTextureSlot(const MXMDTextureLookup *lookup, int id)
+{
+	if (!lookup || id < 0 || id >= static_cast<int>(lookup->size()) || (*lookup)[id].group < 0)
+		return nullptr;
+
+	return &(*lookup)[id];
+}
+
 class MXMDTextures_V1_Wrap : public MXMDTextures
 {
 	char *buffer;
 	CASMTHeader *unchached;
 	CASMTGroup *cached;
+	const MXMDTextureLookup *lookup;
 public:
-	MXMDTextures_V1_Wrap(CASMTHeader *_uncached, char *_buffer, CASMTGroup *_cached) :unchached(_uncached), buffer(_buffer), cached(_cached) {}
+	MXMDTextures_V1_Wrap(CASMTHeader *_uncached, char *_buffer, CASMTGroup *_cached, const MXMDTextureLookup *_lookup) :
+		unchached(_uncached), buffer(_buffer), cached(_cached), lookup(_lookup) {}
 
 	int GetNumTextures() const { return cached->count; }
 	const char *GetTextureName(int id) const
@@ -416,6 +1211,12 @@ public:
 
 	template<class _Ty> int _ExtractTexture(const _Ty *outputFolder, int id, TextureConversionParams params) const;
 
+	int GetTextureStreamGroup(int id) const
+	{
+		const MXMDTextureSlot *slot = buffer && unchached ? FindTextureSlot(lookup, id) : nullptr;
+		return slot ? slot->group : -1;
+	}
+
 	void SwapEndian();
 };
 
@@ -459,6 +1260,32 @@ MXMDGeomVertexWeightBuffer::Ptr MXMDGeometryHeader_V1_Wrap::GetWeightsBuffer(int
 	return MXMDGeomVertexWeightBuffer::Ptr(wbuff);
 }
 
+int MXMDGeomVertexWeightBuffer_V1::NumVertexWeights() const
+{
+	if (!wtb1.size())
+		return 0;
+
+	return wtb1[0]->Size() + (wtb2.size() ? wtb2[0]->Size() : 0);
+}
+
+void MXMDGeomVertexWeightBuffer_V1::GetVertexWeights(int first, int count, MXMDVertexWeight *output) const
+{
+	if (!wtb1.size())
+		return;
+
+	if (!wtb2.size())
+	{
+		DecodeVertexWeights(wtb1, MXMD_WEIGHT32, MXMD_BONEID, first, count, output);
+		return;
+	}
+
+	const int wtb1Size = wtb1[0]->Size();
+	const int numFirst = std::max(std::min(count, wtb1Size - first), 0);
+
+	DecodeVertexWeights(wtb1, MXMD_WEIGHT32, MXMD_BONEID, first, numFirst, output);
+	DecodeVertexWeights(wtb2, MXMD_WEIGHT32, MXMD_BONEID, first + numFirst - wtb1Size, count - numFirst, output + numFirst);
+}
+
 MXMDVertexWeight MXMDGeomVertexWeightBuffer_V1::GetVertexWeight(int at) const
 {
 	MXMDVertexWeight nw = {};
@@ -520,21 +1347,15 @@ int MXMDTextures_V1_Wrap::_ExtractTexture(const _Ty *outputFolder, int id, Textu
 	const char *textureName = nullptr;
 	const char *textureData = nullptr;
 
-	if (buffer && unchached)
-		for (int g = unchached->numGroups - 1; g > -1 && !foundTexture; g--)
-		{
-			short *ids = unchached->GetGroupTextureIDs(g);
-			CASMTGroup *grp = unchached->GetGroup(g);
+	const MXMDTextureSlot *slot = buffer && unchached ? FindTextureSlot(lookup, id) : nullptr;
 
-			for (int i = 0; i < grp->count; i++)
-				if (ids[i] == id)
-				{
-					foundTexture = grp->GetTextures() + i;
-					textureData = buffer + unchached->GetGroupDataOffsets()[g] + foundTexture->offset;
-					textureName = grp->GetMe() + foundTexture->nameOffset;
-					break;
-				}
-		}
+	if (slot)
+	{
+		CASMTGroup *grp = unchached->GetGroup(slot->group);
+		foundTexture = grp->GetTextures() + slot->slot;
+		textureData = buffer + unchached->GetGroupDataOffsets()[slot->group] + foundTexture->offset;
+		textureName = grp->GetMe() + foundTexture->nameOffset;
+	}
 
 	if (!foundTexture && cached)
 	{
@@ -587,6 +1408,11 @@ public:
 	void SwapEndian() { data->SwapEndian(); }
 };
 
+uint64 MXMDShaders::GetShaderHash(int id) const
+{
+	return MTHSContentHash(GetShaderFile(id));
+}
+
 class MXMDExternalTextures_V1_Wrap : public MXMDExternalTextures
 {
 	MXMDExternalTexture_V1 *data;
@@ -642,6 +1468,12 @@ public:
 
 	MXMDMeshObject::Ptr GetMeshObject(int id) const { return MXMDMeshObject::Ptr(new MXMDMeshObject_V3_Wrap(data->GetMeshes(masterBuffer) + id)); }
 	int GetNumMeshObjects() const { return data->meshesCount; }
+	bool GetBounds(Vector &bbMin, Vector &bbMax) const
+	{
+		bbMin = data->BBMin;
+		bbMax = data->BBMax;
+		return true;
+	}
 };
 
 class MXMDBone_V3_Wrap : public MXMDBone
@@ -677,6 +1509,25 @@ public:
 	MXMDBone::Ptr GetSkinBone(int id) const { return GetBone(id); }
 	int GetNumSkinBones() const { return GetNumBones(); }
 
+	// Bones have no parents, stored transforms are both local and absolute.
+	void GetBoneTransforms(MXMDTransformMatrix *local, MXMDTransformMatrix *absolute) const
+	{
+		const MXMDBone_V3 *bones = skinBones->GetBones();
+		const MXMDTransformMatrix *transforms = skinBones->GetTransforms();
+		const int numBones = GetNumBones();
+
+		for (int b = 0; b < numBones; b++)
+		{
+			if (local)
+				local[b] = transforms[bones[b].ID];
+
+			if (absolute)
+				absolute[b] = transforms[bones[b].ID];
+		}
+	}
+
+	void GetSkinBoneTransforms(MXMDTransformMatrix *local, MXMDTransformMatrix *absolute) const { GetBoneTransforms(local, absolute); }
+
 	const char *GetMorphName(int id) const
 	{
 		MXMDMorphControls_V3 *ctrl = data->GetMorphControls();
@@ -697,6 +1548,8 @@ public:
 	MXMDVertexBuffer_V3_Wrap(MXMDVertexBuffer_V3 *input, char *inputBuffer, char *_buffer) : data(input), masterBuffer(inputBuffer), buffer(_buffer) {}
 
 	int NumVertices() const { return data->count; }
+	const char *GetRawBuffer() const { return data->Buffer(buffer); }
+	int GetStride() const { return data->stride; }
 	DescriptorCollection GetDescriptors() const
 	{
 		MXMDVertexType *desc = data->Descriptors(masterBuffer);
@@ -788,20 +1641,105 @@ public:
 	MXMDVertexBuffer::DescriptorCollection GetBaseMorph() const { return GetMorph(0); }
 };
 
+// Mesh object LOD and weight palette LOD share the same levels.
+static int MXMDLODLevel(int LOD)
+{
+	return LOD > 0 ? LOD - 1 : 0;
+}
+
+// Resolves buffers referenced only by mesh objects outside of lodMask.
+// Buffers not referenced by any mesh object (weights, morphs) are always kept.
+struct MXMDLODFilter
+{
+	enum BufferState : char
+	{
+		Unreferenced,
+		Filtered,
+		Kept
+	};
+
+	int lodMask;
+	std::once_flag built;
+	std::vector<char> vertexBuffers;
+	std::vector<char> faceBuffers;
+
+	MXMDLODFilter() : lodMask(0) {}
+
+	bool IsLevelKept(int level) const { return !lodMask || (level < 8 && (lodMask >> level) & 1); }
+
+	static bool IsKept(const std::vector<char> &states, int id)
+	{
+		return id < 0 || id >= static_cast<int>(states.size()) || states[id] != Filtered;
+	}
+
+	bool IsVertexBufferKept(int id) const { return IsKept(vertexBuffers, id); }
+	bool IsFaceBufferKept(int id) const { return IsKept(faceBuffers, id); }
+
+	static void Mark(std::vector<char> &states, int id, bool kept)
+	{
+		if (id < 0 || id >= static_cast<int>(states.size()))
+			return;
+
+		if (kept)
+			states[id] = Kept;
+		else if (states[id] == Unreferenced)
+			states[id] = Filtered;
+	}
+
+	void Build(const MXMDModel &model, int numVertexBuffers, int numFaceBuffers)
+	{
+		if (!lodMask)
+			return;
+
+		vertexBuffers.resize(numVertexBuffers, Unreferenced);
+		faceBuffers.resize(numFaceBuffers, Unreferenced);
+
+		const int numMeshGroups = model.GetNumMeshGroups();
+
+		for (int m = 0; m < numMeshGroups; m++)
+		{
+			MXMDMeshGroup::Ptr cGroup = model.GetMeshGroup(m);
+			const int numMeshObjects = cGroup->GetNumMeshObjects();
+
+			for (int o = 0; o < numMeshObjects; o++)
+			{
+				MXMDMeshObject::Ptr cObject = cGroup->GetMeshObject(o);
+				const bool kept = IsLevelKept(MXMDLODLevel(cObject->GetLODID()));
+
+				Mark(vertexBuffers, cObject->GetBufferID(), kept);
+				Mark(faceBuffers, cObject->GetMeshFacesID(), kept);
+			}
+		}
+	}
+};
+
 class MXMDGeometryHeader_V3_Wrap : public MXMDGeomBuffers
 {
 	MXMDGeometryHeader_V3 *data;
 	MXMDMorphsHeader_V3 *morphData;
+	const MXMDLODFilter *filter;
 public:
-	MXMDGeometryHeader_V3_Wrap(MXMDGeometryHeader_V3 *input) : data(input), morphData(nullptr)
+	MXMDGeometryHeader_V3_Wrap(MXMDGeometryHeader_V3 *input, const MXMDLODFilter *inFilter = nullptr) : data(input), morphData(nullptr), filter(inFilter)
 	{
 		if (data->GetBufferManager())
 			morphData = data->GetBufferManager()->GetMorphHeader(data->GetMe(), data->GetMe() + data->voxelizedModelOffset);
 	}
 
-	MXMDVertexBuffer::Ptr GetVertexBuffer(int id) const { return MXMDVertexBuffer::Ptr(new MXMDVertexBuffer_V3_Wrap(data->GetVertexBuffers() + id, data->GetMe(), data->GetMe() + data->bufferOffset)); }
+	MXMDVertexBuffer::Ptr GetVertexBuffer(int id) const
+	{
+		if (filter && !filter->IsVertexBufferKept(id))
+			return nullptr;
+
+		return MXMDVertexBuffer::Ptr(new MXMDVertexBuffer_V3_Wrap(data->GetVertexBuffers() + id, data->GetMe(), data->GetMe() + data->bufferOffset));
+	}
 	int GetNumVertexBuffers() const { return data->vertexBuffersCount; }
-	MXMDFaceBuffer::Ptr GetFaceBuffer(int id) const { return MXMDFaceBuffer::Ptr(new MXMDFaceBuffer_V3_Wrap(data->GetFaceBuffers() + id, data->GetMe() + data->bufferOffset)); }
+	MXMDFaceBuffer::Ptr GetFaceBuffer(int id) const
+	{
+		if (filter && !filter->IsFaceBufferKept(id))
+			return nullptr;
+
+		return MXMDFaceBuffer::Ptr(new MXMDFaceBuffer_V3_Wrap(data->GetFaceBuffers() + id, data->GetMe() + data->bufferOffset));
+	}
 	int GetNumFaceBuffers() const { return data->faceBuffersCount; }
 	MXMDGeomVertexWeightBuffer::Ptr GetWeightsBuffer(int flags) const;
 	MXMDMorphTargets::Ptr GetVertexBufferMorphTargets(int vertexBufferID) const;
@@ -814,17 +1752,47 @@ public:
 	int bufferOffset;
 
 	MXMDVertexWeight GetVertexWeight(int id) const;
+	int NumVertexWeights() const { return wtb.size() ? wtb[0]->Size() - bufferOffset : 0; }
+	void GetVertexWeights(int first, int count, MXMDVertexWeight *output) const
+	{
+		DecodeVertexWeights(wtb, MXMD_WEIGHT16, MXMD_BONEID2, first + bufferOffset, count, output);
+	}
 };
 
 class MXMDExternalResource_V31 : public MXMDExternalResource
 {
+	std::unique_ptr<BinReader> stream;
+	std::mutex streamMutex;
+	std::unique_ptr<std::once_flag[]> groupFlags;
+	CASMTHeader_V3 *header;
+
+	char *ReadGroup(int group);
 public:
 	std::vector<char *>buffers;
+
+	MXMDExternalResource_V31() : header(nullptr) {}
 	~MXMDExternalResource_V31()
 	{
 		for (auto &b : buffers)
 			free(b);
 	}
+
+	// Groups are read and inflated on first GetGroup call.
+	void SetStream(BinReader *input, CASMTHeader_V3 *inHeader)
+	{
+		stream.reset(input);
+		header = inHeader;
+		buffers.resize(header->numGroups);
+		groupFlags.reset(new std::once_flag[header->numGroups]);
+	}
+
+	char *GetGroup(int group)
+	{
+		if (stream)
+			std::call_once(groupFlags[group], [this, group]() { buffers[group] = ReadGroup(group); });
+
+		return buffers[group];
+	}
 };
 
 class MXMDTextures_V31_Wrap : public MXMDTextures
@@ -832,8 +1800,10 @@ class MXMDTextures_V31_Wrap : public MXMDTextures
 	MXMDExternalResource_V31 *buffers;
 	CASMTHeader_V3 *unchached;
 	CASMTGroup *cached;
+	const MXMDTextureLookup *lookup;
 public:
-	MXMDTextures_V31_Wrap(CASMTHeader_V3 *_uncached, MXMDExternalResource_V31 *_buffer, CASMTGroup *_cached) :unchached(_uncached), buffers(_buffer), cached(_cached) {}
+	MXMDTextures_V31_Wrap(CASMTHeader_V3 *_uncached, MXMDExternalResource_V31 *_buffer, CASMTGroup *_cached, const MXMDTextureLookup *_lookup) :
+		unchached(_uncached), buffers(_buffer), cached(_cached), lookup(_lookup) {}
 
 	int GetNumTextures() const { return cached->count; }
 	const char *GetTextureName(int id) const
@@ -844,6 +1814,12 @@ public:
 	int ExtractTexture(const char *outputFolder, int id, TextureConversionParams params) const { return _ExtractTexture(outputFolder, id, params); }
 
 	template<class _Ty> int _ExtractTexture(const _Ty *outputFolder, int id, TextureConversionParams params) const;
+
+	int GetTextureStreamGroup(int id) const
+	{
+		const MXMDTextureSlot *slot = buffers && unchached ? FindTextureSlot(lookup, id) : nullptr;
+		return slot ? slot->group : -1;
+	}
 };
 
 class MXMDExternalResource_V3 : public MXMDExternalResource, public DRSM {};
@@ -858,6 +1834,7 @@ public:
 	const char *GetTextureName(int id) const { return drsm->GetTextureName(id); }
 	int ExtractTexture(const wchar_t *outputFolder, int id, TextureConversionParams params) const { return drsm->ExtractTexture(outputFolder, id, params); }
 	int ExtractTexture(const char *outputFolder, int id, TextureConversionParams params) const { return drsm->ExtractTexture(outputFolder, id, params); }
+	int GetTextureStreamGroup(int id) const { return drsm->GetTextureStreamGroup(id); }
 };
 
 class MXMDMaterial_V3_Wrap : public MXMDMaterial
@@ -892,15 +1869,23 @@ MXMDGeomVertexWeightBuffer::Ptr MXMDGeometryHeader_V3_Wrap::GetWeightsBuffer(int
 	if (LOD < 0)
 		LOD = 0;
 
+	if (filter && !filter->IsLevelKept(LOD))
+		return nullptr;
+
 	MXMDBBufferManager_V3 *buffMan = data->GetBufferManager();
 
 	if (!buffMan || !buffMan->numWeightPalettes)
 		return nullptr;
 
+	MXMDVertexBuffer::Ptr weightBuffer = GetVertexBuffer(buffMan->weightBufferID);
+
+	if (!weightBuffer)
+		return nullptr;
+
 	MXMDWeightPalette_V3 *wpal = buffMan->GetWeightPalettes(data->GetMe());
 
 	MXMDGeomVertexWeightBuffer_V3 *wbuff = new MXMDGeomVertexWeightBuffer_V3;
-	wbuff->wtb = GetVertexBuffer(buffMan->weightBufferID)->GetDescriptors();
+	wbuff->wtb = weightBuffer->GetDescriptors();
 	wbuff->bufferOffset = 0;
 
 	for (int w = 0; w < buffMan->numWeightPalettes; w++)
@@ -940,7 +1925,7 @@ MXMDVertexWeight MXMDGeomVertexWeightBuffer_V3::GetVertexWeight(int at) const
 
 MXMDMorphTargets::Ptr MXMDGeometryHeader_V3_Wrap::GetVertexBufferMorphTargets(int vertexBufferID) const
 {
-	if (!morphData)
+	if (!morphData || (filter && !filter->IsVertexBufferKept(vertexBufferID)))
 		return nullptr;
 
 	for (int d = 0; d < morphData->descCount; d++)
@@ -951,54 +1936,151 @@ MXMDMorphTargets::Ptr MXMDGeometryHeader_V3_Wrap::GetVertexBufferMorphTargets(in
 			return MXMDMorphTargets::Ptr(new MXMDMorphTargets_V3_Wrap(cDesc, data->GetMe(), morphData->GetBufferHeaders(data->GetMe()), data->GetMe() + data->bufferOffset));
 	}
 
-	return nullptr;
-}
+	return nullptr;
+}
+
+template<class _Ty>
+int MXMDTextures_V31_Wrap::_ExtractTexture(const _Ty *outputFolder, int id, TextureConversionParams params) const
+{
+	CASMTTexture *foundTexture = nullptr;
+	const char *textureName = nullptr;
+	const char *textureData = nullptr;
+
+	const MXMDTextureSlot *slot = unchached && buffers ? FindTextureSlot(lookup, id) : nullptr;
+
+	if (slot)
+	{
+		CASMTGroup *grp = unchached->GetGroup(slot->group);
+		foundTexture = grp->GetTextures() + slot->slot;
+		textureData = buffers->GetGroup(slot->group);
+
+		if (!textureData)
+		{
+			printerror("[LBIM] Cannot load stream group: ", << slot->group);
+			return 1;
+		}
+
+		textureData += foundTexture->offset;
+		textureName = grp->GetMe() + foundTexture->nameOffset;
+	}
+
+	if (!foundTexture && cached)
+	{
+		foundTexture = cached->GetTextures() + id;
+		textureName = cached->GetMe() + foundTexture->nameOffset;
+		textureData = cached->GetMe() + foundTexture->offset;
+	}
+
+	if (!foundTexture)
+	{
+		printerror("[LBIM] Cannot find texture: ", << id);
+		return 1;
+	}
+
+	const UniString<_Ty> tex = outputFolder + esStringConvert<_Ty>(textureName);
+
+	if (ConvertLBIM(textureData, foundTexture->size, tex.c_str(), params))
+	{
+		printerror("[LBIM] Texture: ", << id << " could not be created");
+		return 2;
+	}
+
+	return 0;
+}
+
+static const size_t asyncReadChunkSize = 0x100000;
+
+// Reads whole file in chunks on background thread.
+// Consumers can wait for a byte range to arrive.
+class MXMDAsyncReader
+{
+	BinReader rd;
+	char *buffer;
+	size_t size;
+	size_t bytesRead;
+	std::mutex readMutex;
+	std::condition_variable readSignal;
+	std::thread worker;
+
+	void ReadChunks()
+	{
+		for (size_t cOffset = 0; cOffset < size; cOffset += asyncReadChunkSize)
+		{
+			const size_t cSize = std::min(asyncReadChunkSize, size - cOffset);
+			rd.ReadBuffer(buffer + cOffset, cSize);
+
+			{
+				std::lock_guard<std::mutex> guard(readMutex);
+				bytesRead = cOffset + cSize;
+			}
+
+			readSignal.notify_all();
+		}
+	}
+
+public:
+	template<class _Ty0> MXMDAsyncReader(const _Ty0 &fileName) : rd(fileName), buffer(nullptr), size(0), bytesRead(0)
+	{
+		if (!rd.IsValid())
+			return;
 
-template<class _Ty>
-int MXMDTextures_V31_Wrap::_ExtractTexture(const _Ty *outputFolder, int id, TextureConversionParams params) const
-{
-	CASMTTexture *foundTexture = nullptr;
-	const char *textureName = nullptr;
-	const char *textureData = nullptr;
+		size = rd.GetSize();
+		buffer = static_cast<char *>(malloc(size));
+		worker = std::thread(&MXMDAsyncReader::ReadChunks, this);
+	}
 
-	if (unchached && buffers)
-		for (int g = unchached->numGroups - 1; g > -1 && !foundTexture; g--)
-		{
-			short *ids = unchached->GetGroupTextureIDs(g);
-			CASMTGroup *grp = unchached->GetGroup(g);
+	~MXMDAsyncReader()
+	{
+		free(Release());
+	}
 
-			for (int i = 0; i < grp->count; i++)
-				if (ids[i] == id)
-				{
-					foundTexture = grp->GetTextures() + i;
-					textureData = buffers->buffers[g] + foundTexture->offset;
-					textureName = grp->GetMe() + foundTexture->nameOffset;
-					break;
-				}
-		}
+	bool IsValid() const { return buffer != nullptr; }
+	size_t GetSize() const { return size; }
+	char *GetBuffer() { return buffer; }
 
-	if (!foundTexture && cached)
+	// Blocks until [0, end) range is loaded.
+	void WaitFor(size_t end)
 	{
-		foundTexture = cached->GetTextures() + id;
-		textureName = cached->GetMe() + foundTexture->nameOffset;
-		textureData = cached->GetMe() + foundTexture->offset;
+		end = std::min(end, size);
+		std::unique_lock<std::mutex> lock(readMutex);
+		readSignal.wait(lock, [this, end]() { return bytesRead >= end; });
 	}
 
-	if (!foundTexture)
+	// Waits for whole file, caller takes ownership of buffer.
+	char *Release()
 	{
-		printerror("[LBIM] Cannot find texture: ", << id);
-		return 1;
+		if (worker.joinable())
+			worker.join();
+
+		char *retVal = buffer;
+		buffer = nullptr;
+		return retVal;
 	}
+};
 
-	const UniString<_Ty> tex = outputFolder + esStringConvert<_Ty>(textureName);
+// magic, numFiles, uncompSize, size, hash, name[28]
+static const size_t xbc1HeaderSize = 48;
+
+char *MXMDExternalResource_V31::ReadGroup(int group)
+{
+	const int groupOffset = header->GetGroupDataOffsets()[group];
+	std::vector<char> groupData(xbc1HeaderSize);
 
-	if (ConvertLBIM(textureData, foundTexture->size, tex.c_str(), params))
 	{
-		printerror("[LBIM] Texture: ", << id << " could not be created");
-		return 2;
+		std::lock_guard<std::mutex> guard(streamMutex);
+		stream->Seek(groupOffset);
+		stream->ReadBuffer(groupData.data(), xbc1HeaderSize);
+
+		const int compressedSize = reinterpret_cast<const int *>(groupData.data())[3];
+
+		if (compressedSize < 0 || groupOffset + xbc1HeaderSize + compressedSize > stream->GetSize())
+			return nullptr;
+
+		groupData.resize(xbc1HeaderSize + compressedSize);
+		stream->ReadBuffer(groupData.data() + xbc1HeaderSize, compressedSize);
 	}
 
-	return 0;
+	return ExtractXBC(groupData.data());
 }
 
 struct xbc1QueueInternal
@@ -1008,14 +2090,22 @@ struct xbc1QueueInternal
 	int *offsets;
 	char *mainBuffer;
 	std::vector<char *> *buffers;
+	MXMDAsyncReader *reader;
 
 	typedef void return_type;
 
-	xbc1QueueInternal() : queue(0) {}
+	xbc1QueueInternal() : queue(0), reader(nullptr) {}
 
 	return_type RetreiveItem()
 	{
 		char *resBuffer = mainBuffer + offsets[queue];
+
+		if (reader)
+		{
+			reader->WaitFor(offsets[queue] + xbc1HeaderSize);
+			reader->WaitFor(offsets[queue] + xbc1HeaderSize + reinterpret_cast<const int *>(resBuffer)[3]);
+		}
+
 		buffers->at(queue) = ExtractXBC(resBuffer);
 	}
 
@@ -1024,8 +2114,67 @@ struct xbc1QueueInternal
 	int NumQueues() const { return queueEnd; }
 };
 
+static void _SwapExternalBufferIDs(MXMDHeader *header)
+{
+	if (!header->externalBufferIDsOffset)
+		return;
+
+	if (header->externalBufferIDsCount < 0)
+		reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(header->GetMe() + header->externalBufferIDsOffset)->SwapEndian();
+	else
+	{
+		int *indices = reinterpret_cast<int *>(header->GetMe() + header->externalBufferIDsOffset);
+
+		for (int i = 0; i < header->externalBufferIDsCount; i++)
+			FByteswapper(indices[i]);
+	}
+}
+
+// Per file state, that lives alongside loaded buffers.
+struct MXMDCache
+{
+	bool lazyEndian;
+	std::once_flag model;
+	std::once_flag materials;
+	std::once_flag textures;
+	std::once_flag instances;
+	std::once_flag shaders;
+	std::once_flag externalTextures;
+	std::mutex geometryMutex;
+	std::map<const void *, std::once_flag> geometry;
+	MXMDTextureLookup textureLookup;
+	MXMDTerrainStream_V1 *terrainStream;
+	std::once_flag terrainBounds;
+	MXMDSkeleton_V1 skeleton;
+	MXMDLODFilter lodFilter;
+
+	struct VertexWeights
+	{
+		std::once_flag decoded;
+		std::vector<MXMDVertexWeight> items;
+	};
+
+	std::mutex weightsMutex;
+	// [groupID, flags]
+	std::map<std::pair<int, int>, VertexWeights> vertexWeights;
+
+	MXMDCache() : lazyEndian(false), terrainStream(nullptr) {}
+
+	template<class _Func> void SwapOnce(std::once_flag &flag, _Func func)
+	{
+		if (lazyEndian)
+			std::call_once(flag, func);
+	}
+
+	std::once_flag &GeometryFlag(const void *geometryHeader)
+	{
+		std::lock_guard<std::mutex> guard(geometryMutex);
+		return geometry[geometryHeader];
+	}
+};
+
 template<class _Ty0>
-int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
+int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors, MXMDLoadParams params)
 {
 	BinReader rd(fileName);
 
@@ -1081,13 +2230,39 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 		return 3;
 	}
 
+	UniString<_Ty0> fileNameExternal = fileName;
+	fileNameExternal.replace(fileNameExternal.size() - 3, 3, esString("smt"));
+
+	std::unique_ptr<MXMDAsyncReader> asyncResource;
+
+	int numExternalBuffers = hdr.externalBufferIDsCount;
+
+	if (hdr.magic == ID_BIG)
+		FByteswapper(numExternalBuffers);
+
+	const bool streamTerrain = params.streamTerrain && hdr.version == MXMDVer1 && hdr.externalBufferIDsOffset && numExternalBuffers < 0;
+
+	if (params.asyncLoad && ((hdr.version == MXMDVer1 && !streamTerrain) || (hdr.cachedTexturesOffset && !params.lazyStreams)))
+		asyncResource.reset(new MXMDAsyncReader(fileNameExternal));
+
 	rd.Seek(0);
 	const size_t fileSize = rd.GetSize();
 
 	data.masterBuffer = static_cast<char *>(malloc(fileSize));
 	rd.ReadBuffer(data.masterBuffer, fileSize);
 
-	if (rd.SwappedEndian())
+	cache = new MXMDCache;
+	cache->lazyEndian = params.lazyEndian && rd.SwappedEndian();
+	cache->lodFilter.lodMask = params.lodMask;
+
+	MXMDSwapJobs swapJobs;
+
+	if (cache->lazyEndian)
+	{
+		data.header->SwapEndian();
+		_SwapExternalBufferIDs(data.header);
+	}
+	else if (rd.SwappedEndian())
 	{
 		data.header->SwapEndian();
 		GetModel()->SwapEndian();
@@ -1095,7 +2270,12 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 		MXMDGeomBuffers::Ptr geom = GetGeometry();
 
 		if (geom)
-			geom->SwapEndian();
+		{
+			if (hdr.version == MXMDVer1)
+				static_cast<MXMDGeometryHeader_V1_Wrap &>(*geom).CollectSwapJobs(swapJobs);
+			else
+				geom->SwapEndian();
+		}
 
 		MXMDTextures::Ptr textures = GetTextures();
 
@@ -1118,68 +2298,71 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 			extexts->SwapEndian();
 
 		GetMaterials()->SwapEndian();
+		_SwapExternalBufferIDs(data.header);
+	}
 
-		if (data.header->externalBufferIDsOffset)
+	switch (hdr.version)
+	{
+	case MXMDVer1:
+	{
+		if (streamTerrain)
 		{
-			if (data.header->externalBufferIDsCount < 0)
-				reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(data.masterBuffer + data.header->externalBufferIDsOffset)->SwapEndian();
+			BinReader *res = new BinReader(fileNameExternal);
+
+			if (res->IsValid())
+			{
+				cache->terrainStream = new MXMDTerrainStream_V1(res, reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(data.masterBuffer + data.header->externalBufferIDsOffset), rd.SwappedEndian());
+				externalResource = cache->terrainStream;
+			}
 			else
 			{
-				int *indices = reinterpret_cast<int *>(data.masterBuffer + data.header->externalBufferIDsOffset);
-
-				for (int i = 0; i < data.header->externalBufferIDsCount; i++)
-					FByteswapper(indices[i]);
+				delete res;
+				printerror("[MXMD] Cannot load external buffer: ", << fileNameExternal.c_str());
 			}
-		}
-	}
 
-	UniString<_Ty0> fileNameExternal = fileName;
-	fileNameExternal.replace(fileNameExternal.size() - 3, 3, esString("smt"));
+			break;
+		}
 
-	switch (hdr.version)
-	{
-	case MXMDVer1:
-	{
-		BinReader res(fileNameExternal);
+		char *resBuffer = nullptr;
 
-		if (res.IsValid())
+		if (asyncResource)
+			resBuffer = asyncResource->Release();
+		else
 		{
-			const size_t _fileSize = res.GetSize();
+			BinReader res(fileNameExternal);
+
+			if (res.IsValid())
+			{
+				const size_t _fileSize = res.GetSize();
+				resBuffer = static_cast<char *>(malloc(_fileSize));
+				res.ReadBuffer(resBuffer, _fileSize);
+			}
+		}
 
+		if (resBuffer)
+		{
 			MXMDExternalResource_V1 *externalResourcev1 = new MXMDExternalResource_V1;
-			externalResourcev1->buffer = static_cast<char *>(malloc(_fileSize));
-			res.ReadBuffer(externalResourcev1->buffer, _fileSize);
+			externalResourcev1->buffer = resBuffer;
 			externalResource = externalResourcev1;
 
-			if (data.header->externalBufferIDsOffset)
+			if (data.header->externalBufferIDsOffset && !cache->lazyEndian && cache->lodFilter.IsLevelKept(0))
 			{
-				std::vector<int> flippedOffsets;
+				std::unordered_set<int> flippedOffsets;
 
 				if (data.header->externalBufferIDsCount < 0)
 				{
 					MXMDTerrainBufferLookupHeader_V1 *lookups = reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(data.masterBuffer + data.header->externalBufferIDsOffset);
 					MXMDTerrainBufferLookup_V1 *bufferLookups = lookups->GetBufferLookups();
-					int curBuff = 0;
 
 					for (int i = 0; i < lookups->bufferLookupCount; i++)
-						for (int s = 0; s < 2; s++, curBuff++)
+						for (int s = 0; s < 2; s++)
 						{
 							const int &cIndex = bufferLookups[i].bufferIndex[s];
-							bool found = false;
 
-							for (auto &o : flippedOffsets)
-								if (o == cIndex)
-								{
-									found = true;
-									break;
-								}
-
-							if (found)
+							if (!flippedOffsets.insert(cIndex).second)
 								continue;
 
-							flippedOffsets.push_back(cIndex);
-
-							MXMDGeometryHeader_V1_Wrap(reinterpret_cast<MXMDGeometryHeader_V1 *>(externalResourcev1->buffer + bufferLookups[i].bufferIndex[s])).SwapEndian();
+							MXMDGeometryHeader_V1_Wrap(reinterpret_cast<MXMDGeometryHeader_V1 *>(externalResourcev1->buffer + cIndex)).CollectSwapJobs(swapJobs);
 						}
 				}
 				else
@@ -1189,26 +2372,16 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 					for (int i = 0; i < data.header->externalBufferIDsCount; i++)
 					{
 						const int &cIndex = indices[i];
-						bool found = false;
 
-						for (auto &o : flippedOffsets)
-							if (o == cIndex)
-							{
-								found = true;
-								break;
-							}
-
-						if (found)
+						if (!flippedOffsets.insert(cIndex).second)
 							continue;
 
-						flippedOffsets.push_back(cIndex);
-
 						MXMDGeomBuffers::Ptr geom = GetGeometry(i);
 
 						if (!geom)
 							continue;
 
-						geom->SwapEndian();
+						static_cast<MXMDGeometryHeader_V1_Wrap &>(*geom).CollectSwapJobs(swapJobs);
 					}
 				}
 			}
@@ -1231,17 +2404,42 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 			else
 				externalResource = externalResourcev3;
 		}
+		else if (params.lazyStreams)
+		{
+			BinReader *res = new BinReader(fileNameExternal);
+
+			if (res->IsValid())
+			{
+				MXMDExternalResource_V31 *externalResourcev31 = new MXMDExternalResource_V31;
+				externalResourcev31->SetStream(res, reinterpret_cast<CASMTHeader_V3 *>(data.header->GetMe() + data.header->uncachedTexturesOffset));
+				externalResource = externalResourcev31;
+			}
+			else
+			{
+				delete res;
+				printerror("[MXMD] Cannot load external buffer: ", << fileNameExternal.c_str());
+			}
+		}
 		else
 		{
-			BinReader res(fileNameExternal);
+			char *resBuffer = nullptr;
 
-			if (res.IsValid())
+			if (asyncResource)
+				resBuffer = asyncResource->GetBuffer();
+			else
 			{
-				const size_t _fileSize = res.GetSize();
+				BinReader res(fileNameExternal);
 
-				char *resBuffer = static_cast<char *>(malloc(_fileSize));
-				res.ReadBuffer(resBuffer, _fileSize);
+				if (res.IsValid())
+				{
+					const size_t _fileSize = res.GetSize();
+					resBuffer = static_cast<char *>(malloc(_fileSize));
+					res.ReadBuffer(resBuffer, _fileSize);
+				}
+			}
 
+			if (resBuffer)
+			{
 				MXMDExternalResource_V31 *externalResourcev31 = new MXMDExternalResource_V31;
 				CASMTHeader_V3 *reshdrData = reinterpret_cast<CASMTHeader_V3 *>(data.header->GetMe() + data.header->uncachedTexturesOffset);
 
@@ -1250,11 +2448,16 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 				xbcQue.offsets = reshdrData->GetGroupDataOffsets();
 				xbcQue.buffers = &externalResourcev31->buffers;
 				xbcQue.mainBuffer = resBuffer;
+				xbcQue.reader = asyncResource.get();
 				externalResourcev31->buffers.resize(xbcQue.queueEnd);
 
-				RunThreadedQueue(xbcQue);
+				RunScheduledQueue(xbcQue);
 
 				externalResource = externalResourcev31;
+
+				if (asyncResource)
+					asyncResource->Release();
+
 				free(resBuffer);
 			}
 			else
@@ -1267,18 +2470,28 @@ int MXMD::_Load(const _Ty0 *fileName, bool suppressErrors)
 		break;
 	}
 	}
+
+	RunSwapJobs(swapJobs);
+
+	if (!cache->lazyEndian)
+		BuildTextureLookup(data.header, cache->textureLookup);
+
 	return 0;
 }
 
-template int MXMD::_Load(const char *fileName, bool suppressErrors);
-template int MXMD::_Load(const wchar_t *fileName, bool suppressErrors);
+template int MXMD::_Load(const char *fileName, bool suppressErrors, MXMDLoadParams params);
+template int MXMD::_Load(const wchar_t *fileName, bool suppressErrors, MXMDLoadParams params);
 
 MXMDModel::Ptr MXMD::GetModel()
 { 
 	switch (data.header->version)
 	{
 	case MXMDVer1:
-		return MXMDModel::Ptr(new MXMDModel_V1_Wrap(reinterpret_cast<MXMDModel_V1 *>(data.masterBuffer + data.header->modelsOffset)));
+	{
+		MXMDModel_V1 *model = reinterpret_cast<MXMDModel_V1 *>(data.masterBuffer + data.header->modelsOffset);
+		cache->SwapOnce(cache->model, [model]() { model->SwapEndian(); });
+		return MXMDModel::Ptr(new MXMDModel_V1_Wrap(model, &cache->skeleton));
+	}
 
 	case MXMDVer3:
 		return MXMDModel::Ptr(new MXMDModel_V3_Wrap(reinterpret_cast<MXMDModel_V3 *>(data.masterBuffer + data.header->modelsOffset)));
@@ -1292,7 +2505,11 @@ MXMDMaterials::Ptr MXMD::GetMaterials()
 	switch (data.header->version)
 	{
 	case MXMDVer1:
-		return MXMDMaterials::Ptr(new MXMDMaterials_V1_Wrap(reinterpret_cast<MXMDMaterialsHeader_V1 *>(data.masterBuffer + data.header->materialsOffset)));
+	{
+		MXMDMaterials::Ptr materials(new MXMDMaterials_V1_Wrap(reinterpret_cast<MXMDMaterialsHeader_V1 *>(data.masterBuffer + data.header->materialsOffset)));
+		cache->SwapOnce(cache->materials, [&materials]() { materials->SwapEndian(); });
+		return materials;
+	}
 
 	case MXMDVer3:
 		return MXMDMaterials::Ptr(new MXMDMaterials_V3_Wrap(reinterpret_cast<MXMDMaterialsHeader_V3 *>(data.masterBuffer + data.header->materialsOffset)));
@@ -1308,76 +2525,85 @@ MXMDGeomBuffers::Ptr MXMD::GetGeometry(int groupID)
 	{
 	case MXMDVer1:
 	{
+		// V1 meshes have no LOD levels
+		if (!cache->lodFilter.IsLevelKept(0))
+			return nullptr;
+
+		MXMDGeometryHeader_V1 *geometryHeader = nullptr;
+
 		if (data.header->vertexBufferOffset)
-			return MXMDGeomBuffers::Ptr
-			(
-				new MXMDGeometryHeader_V1_Wrap
-				(
-					reinterpret_cast<MXMDGeometryHeader_V1 *>(data.masterBuffer + data.header->vertexBufferOffset)
-				)
-			);
+			geometryHeader = reinterpret_cast<MXMDGeometryHeader_V1 *>(data.masterBuffer + data.header->vertexBufferOffset);
 		else if (data.header->externalBufferIDsOffset)
 		{
 			MXMDExternalResource_V1 *res = static_cast<MXMDExternalResource_V1 *>(externalResource);
-			if (res)
-			{
-				if (data.header->externalBufferIDsCount < 0)
-				{
-					MXMDTerrainBufferLookupHeader_V1 *lookups = reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(data.masterBuffer + data.header->externalBufferIDsOffset);
-					MXMDTerrainBufferLookup_V1 *bufferLookups = lookups->GetBufferLookups();
-					ushort *indices = lookups->GetGroupIndices();
 
-					int outerIndex = indices[groupID];
-					int innerIndex = 0;
-					
-					if (outerIndex >= lookups->bufferLookupCount)
-					{
-						outerIndex -= lookups->bufferLookupCount;
-						innerIndex = 1;
-					}
+			if (!res)
+				return nullptr;
 
-					return MXMDGeomBuffers::Ptr
-					(
-						new MXMDGeometryHeader_V1_Wrap
-						(
-							reinterpret_cast<MXMDGeometryHeader_V1 *>(res->buffer + bufferLookups[outerIndex].bufferIndex[innerIndex])
-						)
-					);
-				}
-				else
+			if (data.header->externalBufferIDsCount < 0)
+			{
+				MXMDTerrainBufferLookupHeader_V1 *lookups = reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(data.masterBuffer + data.header->externalBufferIDsOffset);
+				MXMDTerrainBufferLookup_V1 *bufferLookups = lookups->GetBufferLookups();
+				ushort *indices = lookups->GetGroupIndices();
+
+				int outerIndex = indices[groupID];
+				int innerIndex = 0;
+				
+				if (outerIndex >= lookups->bufferLookupCount)
 				{
-					int *indices = reinterpret_cast<int *>(data.masterBuffer + data.header->externalBufferIDsOffset);
-					return MXMDGeomBuffers::Ptr
-					(
-						new MXMDGeometryHeader_V1_Wrap
-						(
-							reinterpret_cast<MXMDGeometryHeader_V1 *>(res->buffer + indices[groupID])
-						)
-					);
+					outerIndex -= lookups->bufferLookupCount;
+					innerIndex = 1;
 				}
+
+				if (cache->terrainStream)
+					return cache->terrainStream->GetGeometry(bufferLookups[outerIndex].bufferIndex[innerIndex]);
+
+				geometryHeader = reinterpret_cast<MXMDGeometryHeader_V1 *>(res->buffer + bufferLookups[outerIndex].bufferIndex[innerIndex]);
 			}
 			else
-				return nullptr;
+			{
+				int *indices = reinterpret_cast<int *>(data.masterBuffer + data.header->externalBufferIDsOffset);
+				geometryHeader = reinterpret_cast<MXMDGeometryHeader_V1 *>(res->buffer + indices[groupID]);
+			}
 		}
 		else
 			return nullptr;
+
+		MXMDGeomBuffers::Ptr geometry(new MXMDGeometryHeader_V1_Wrap(geometryHeader));
+
+		if (cache->lazyEndian)
+			cache->SwapOnce(cache->GeometryFlag(geometryHeader), [&geometry]() { geometry->SwapEndian(); });
+
+		return geometry;
 	}
 
 	case MXMDVer3:
 	{
+		MXMDGeometryHeader_V3 *geometryHeader = nullptr;
+
 		if (data.header->vertexBufferOffset)
-			return MXMDGeomBuffers::Ptr
-			(
-				new MXMDGeometryHeader_V3_Wrap
-				(
-					reinterpret_cast<MXMDGeometryHeader_V3 *>(data.masterBuffer + data.header->vertexBufferOffset)
-				)
-			);
+			geometryHeader = reinterpret_cast<MXMDGeometryHeader_V3 *>(data.masterBuffer + data.header->vertexBufferOffset);
 		else
 		{
 			MXMDExternalResource_V3 *res = static_cast<MXMDExternalResource_V3 *>(externalResource);
-			return MXMDGeomBuffers::Ptr(new MXMDGeometryHeader_V3_Wrap(reinterpret_cast<MXMDGeometryHeader_V3 *>(res->GetResource(0))));
+
+			if (!res)
+				return nullptr;
+
+			geometryHeader = reinterpret_cast<MXMDGeometryHeader_V3 *>(res->GetResource(0));
 		}
+
+		MXMDLODFilter &lodFilter = cache->lodFilter;
+
+		std::call_once(lodFilter.built, [this, &lodFilter, geometryHeader]()
+		{
+			MXMDModel::Ptr model = GetModel();
+
+			if (model)
+				lodFilter.Build(*model, geometryHeader->vertexBuffersCount, geometryHeader->faceBuffersCount);
+		});
+
+		return MXMDGeomBuffers::Ptr(new MXMDGeometryHeader_V3_Wrap(geometryHeader, &lodFilter));
 	}
 
 	default:
@@ -1385,6 +2611,51 @@ MXMDGeomBuffers::Ptr MXMD::GetGeometry(int groupID)
 	}
 }
 
+MXMDVertexWeightSpan MXMD::GetVertexWeights(int flags, int groupID)
+{
+	MXMDCache::VertexWeights *weights = nullptr;
+
+	{
+		std::lock_guard<std::mutex> guard(cache->weightsMutex);
+		weights = &cache->vertexWeights[std::make_pair(groupID, flags)];
+	}
+
+	std::call_once(weights->decoded, [this, weights, flags, groupID]()
+	{
+		MXMDGeomBuffers::Ptr geom = GetGeometry(groupID);
+
+		if (!geom)
+			return;
+
+		MXMDGeomVertexWeightBuffer::Ptr wBuffer = geom->GetWeightsBuffer(flags);
+
+		if (!wBuffer)
+			return;
+
+		weights->items.resize(wBuffer->NumVertexWeights());
+		wBuffer->GetVertexWeights(0, static_cast<int>(weights->items.size()), weights->items.data());
+	});
+
+	return MXMDVertexWeightSpan(weights->items.data(), static_cast<int>(weights->items.size()));
+}
+
+MXMDTerrainStream *MXMD::GetTerrainStream()
+{
+	if (!cache || !cache->terrainStream)
+		return nullptr;
+
+	std::call_once(cache->terrainBounds, [this]()
+	{
+		MXMDModel::Ptr model = GetModel();
+		MXMDInstances::Ptr instances = GetInstances();
+
+		if (model)
+			cache->terrainStream->BuildBounds(*model, instances.get());
+	});
+
+	return cache->terrainStream;
+}
+
 MXMDTextures::Ptr MXMD::GetTextures()
 {
 	switch (data.header->version)
@@ -1395,10 +2666,17 @@ MXMDTextures::Ptr MXMD::GetTextures()
 			return nullptr;
 
 		MXMDExternalResource_V1 *res = static_cast<MXMDExternalResource_V1 *>(externalResource);
-		return MXMDTextures::Ptr(new MXMDTextures_V1_Wrap(reinterpret_cast<CASMTHeader *>(
+		MXMDTextures::Ptr textures(new MXMDTextures_V1_Wrap(reinterpret_cast<CASMTHeader *>(
 			data.header->uncachedTexturesOffset ? data.masterBuffer + data.header->uncachedTexturesOffset : nullptr),
 			res ? res->buffer : nullptr,
-			reinterpret_cast<CASMTGroup *>(data.masterBuffer + data.header->cachedTexturesOffset)));
+			reinterpret_cast<CASMTGroup *>(data.masterBuffer + data.header->cachedTexturesOffset),
+			&cache->textureLookup));
+		cache->SwapOnce(cache->textures, [this, &textures]()
+		{
+			textures->SwapEndian();
+			BuildTextureLookup(data.header, cache->textureLookup);
+		});
+		return textures;
 	}
 
 	case MXMDVer3:
@@ -1411,7 +2689,8 @@ MXMDTextures::Ptr MXMD::GetTextures()
 			return MXMDTextures::Ptr(new MXMDTextures_V31_Wrap(reinterpret_cast<CASMTHeader_V3 *>(
 				data.masterBuffer + data.header->uncachedTexturesOffset),
 				res,
-				reinterpret_cast<CASMTGroup *>(data.masterBuffer + data.header->cachedTexturesOffset)));
+				reinterpret_cast<CASMTGroup *>(data.masterBuffer + data.header->cachedTexturesOffset),
+				&cache->textureLookup));
 		}
 	}
 
@@ -1429,13 +2708,15 @@ MXMDInstances::Ptr MXMD::GetInstances()
 		if (!data.header->instancesOffset)
 			return nullptr;
 
-		return MXMDInstances::Ptr
+		MXMDInstances::Ptr instances
 		(
 			new MXMDInstances_V1_Wrap
 			(
 				reinterpret_cast<MXMDInstancesHeader_V1 *>(data.header->GetMe() + data.header->instancesOffset)
 			)
 		);
+		cache->SwapOnce(cache->instances, [&instances]() { instances->SwapEndian(); });
+		return instances;
 	}
 
 	default:
@@ -1451,13 +2732,17 @@ MXMDShaders::Ptr MXMD::GetShaders()
 	switch (data.header->version)
 	{
 	case MXMDVer1:
-		return MXMDShaders::Ptr
+	{
+		MXMDShaders::Ptr shaders
 		(
 			new MXMDShaders_V1_Wrap
 			(
 				reinterpret_cast<MXMDShadersHeader_V1 *>(data.header->GetMe() + data.header->shadersOffset)
 			)
 		);
+		cache->SwapOnce(cache->shaders, [&shaders]() { shaders->SwapEndian(); });
+		return shaders;
+	}
 
 	default:
 		return nullptr;
@@ -1472,7 +2757,8 @@ MXMDExternalTextures::Ptr MXMD::GetExternalTextures()
 	switch (data.header->version)
 	{
 	case MXMDVer1:
-		return MXMDExternalTextures::Ptr
+	{
+		MXMDExternalTextures::Ptr extexts
 		(
 			new MXMDExternalTextures_V1_Wrap
 			(
@@ -1480,6 +2766,9 @@ MXMDExternalTextures::Ptr MXMD::GetExternalTextures()
 				data.header->externalTexturesCount
 			)
 		);
+		cache->SwapOnce(cache->externalTextures, [&extexts]() { extexts->SwapEndian(); });
+		return extexts;
+	}
 
 	default:
 		return nullptr;
@@ -1494,6 +2783,7 @@ struct TextureQueue
 	const MXMDTextures *caller;
 	TextureConversionParams params;
 	const _Ty *folderPath;
+	const int *order;
 
 	typedef int return_type;
 
@@ -1501,7 +2791,7 @@ struct TextureQueue
 
 	return_type RetreiveItem()
 	{
-		int result = caller->ExtractTexture(folderPath, queue, params);
+		int result = caller->ExtractTexture(folderPath, order[queue], params);
 		return result;
 	}
 
@@ -1510,23 +2800,125 @@ struct TextureQueue
 	int NumQueues() const { return queueEnd; }
 };
 
-
 template<class _Ty>
-int MXMDTextures::_ExtractAllTextures(const _Ty *outputFolder, TextureConversionParams params) const
+int MXMDTextures::_ExtractTextures(const _Ty *outputFolder, const int *ids, int numIDs, TextureConversionParams params) const
 {
+	// [group, textureID]
+	std::vector<std::pair<int, int>> groups(numIDs);
+	std::vector<int> order(numIDs);
+
+	for (int t = 0; t < numIDs; t++)
+		groups[t] = std::make_pair(GetTextureStreamGroup(ids[t]), ids[t]);
+
+	// Keep textures sharing stream group together
+	std::stable_sort(groups.begin(), groups.end(), [](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first < b.first; });
+
+	for (int t = 0; t < numIDs; t++)
+		order[t] = groups[t].second;
+
+	std::vector<int> results(numIDs);
+
 	TextureQueue<_Ty> texQue;
 	texQue.params = params;
 	texQue.caller = this;
-	texQue.queueEnd = GetNumTextures();
+	texQue.queueEnd = numIDs;
 	texQue.folderPath = outputFolder;
+	texQue.order = order.data();
 	
-	RunThreadedQueue(texQue);
+	RunScheduledQueue(texQue, results.data());
+
+	int numFailed = 0;
+
+	for (int r : results)
+		numFailed += r != 0;
+
+	return numFailed;
+}
+
+template<class _Ty>
+int MXMDTextures::_ExtractAllTextures(const _Ty *outputFolder, TextureConversionParams params) const
+{
+	const int numTextures = GetNumTextures();
+	std::vector<int> ids(numTextures);
+
+	for (int t = 0; t < numTextures; t++)
+		ids[t] = t;
+
+	_ExtractTextures(outputFolder, ids.data(), numTextures, params);
 
 	return 0;
 }
 
 template int MXMDTextures::_ExtractAllTextures(const char *outputFolder, TextureConversionParams params) const;
 template int MXMDTextures::_ExtractAllTextures(const wchar_t *outputFolder, TextureConversionParams params) const;
+template int MXMDTextures::_ExtractTextures(const char *outputFolder, const int *ids, int numIDs, TextureConversionParams params) const;
+template int MXMDTextures::_ExtractTextures(const wchar_t *outputFolder, const int *ids, int numIDs, TextureConversionParams params) const;
+
+std::vector<MXMDTextureReference> MXMD::GetMaterialTextures()
+{
+	std::vector<MXMDTextureReference> references;
+	MXMDMaterials::Ptr materials = GetMaterials();
+
+	if (!materials)
+		return references;
+
+	// Material texture indices point into external textures when file has them
+	MXMDExternalTextures::Ptr extexts = GetExternalTextures();
+	const int numExternal = extexts ? extexts->GetNumTextures() : 0;
+	const int numMaterials = materials->GetNumMaterials();
+
+	for (int m = 0; m < numMaterials; m++)
+	{
+		MXMDMaterial::Ptr cMaterial = materials->GetMaterial(m);
+		const int numTextures = cMaterial->GetNumTextures();
+
+		for (int t = 0; t < numTextures; t++)
+		{
+			const int textureIndex = cMaterial->GetTextureIndex(t);
+			MXMDTextureReference cRef = {textureIndex, -1};
+
+			if (textureIndex < 0)
+				continue;
+
+			if (extexts)
+			{
+				if (textureIndex >= numExternal)
+					continue;
+
+				cRef.textureID = extexts->GetExTextureID(textureIndex);
+				cRef.containerID = extexts->GetContainerID(textureIndex);
+			}
+
+			references.push_back(cRef);
+		}
+	}
+
+	std::sort(references.begin(), references.end());
+	references.erase(std::unique(references.begin(), references.end()), references.end());
+
+	return references;
+}
+
+template<class _Ty0>
+int MXMD::_ExtractMaterialTextures(const _Ty0 *outputFolder, TextureConversionParams params)
+{
+	MXMDTextures::Ptr textures = GetTextures();
+
+	if (!textures)
+		return -1;
+
+	const int numTextures = textures->GetNumTextures();
+	std::vector<int> ids;
+
+	for (auto &r : GetMaterialTextures())
+		if (r.containerID < 0 && r.textureID < numTextures)
+			ids.push_back(r.textureID);
+
+	return textures->ExtractTextures(outputFolder, ids.data(), static_cast<int>(ids.size()), params);
+}
+
+template int MXMD::_ExtractMaterialTextures(const char *outputFolder, TextureConversionParams params);
+template int MXMD::_ExtractMaterialTextures(const wchar_t *outputFolder, TextureConversionParams params);
 
 MXMD::~MXMD()
 {
@@ -1535,4 +2927,7 @@ MXMD::~MXMD()
 
 	if (externalResource)
 		delete externalResource;
+
+	if (cache)
+		delete cache;
 }
\ No newline at end of file
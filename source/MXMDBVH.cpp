@@ -0,0 +1,522 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MXMDBVH.h"
+#include "XenoLibScheduler.h"
+#include <algorithm>
+#include <cfloat>
+#include <emmintrin.h>
+
+static const int bvhMaxLeafItems = 4;
+static const int bvhNumBins = 16;
+// Ranges below this size are built by a single thread.
+static const int bvhMinTaskItems = 512;
+static const int bvhMaxTaskDepth = 6;
+
+struct BVHBox {
+  Vector bbMin, bbMax;
+
+  BVHBox()
+      : bbMin(FLT_MAX, FLT_MAX, FLT_MAX), bbMax(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+  }
+
+  void Extend(const Vector &inMin, const Vector &inMax) {
+    for (int c = 0; c < 3; c++) {
+      bbMin[c] = std::min(bbMin[c], inMin[c]);
+      bbMax[c] = std::max(bbMax[c], inMax[c]);
+    }
+  }
+
+  float Area() const {
+    const float dx = bbMax.X - bbMin.X;
+    const float dy = bbMax.Y - bbMin.Y;
+    const float dz = bbMax.Z - bbMin.Z;
+
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+      return 0.0f;
+
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+  }
+};
+
+// Arvo's method, transformed box encloses all 8 transformed corners.
+static void TransformBounds(const MXMDTransformMatrix &mtx,
+                            const Vector &inMin, const Vector &inMax,
+                            Vector &outMin, Vector &outMax) {
+  __m128 rMin = _mm_loadu_ps(reinterpret_cast<const float *>(&mtx.m[3]));
+  __m128 rMax = rMin;
+
+  for (int r = 0; r < 3; r++) {
+    const __m128 row = _mm_loadu_ps(reinterpret_cast<const float *>(&mtx.m[r]));
+    const __m128 a = _mm_mul_ps(row, _mm_set1_ps(inMin[r]));
+    const __m128 b = _mm_mul_ps(row, _mm_set1_ps(inMax[r]));
+    rMin = _mm_add_ps(rMin, _mm_min_ps(a, b));
+    rMax = _mm_add_ps(rMax, _mm_max_ps(a, b));
+  }
+
+  alignas(16) float result[2][4];
+  _mm_store_ps(result[0], rMin);
+  _mm_store_ps(result[1], rMax);
+  outMin = Vector(result[0][0], result[0][1], result[0][2]);
+  outMax = Vector(result[1][0], result[1][1], result[1][2]);
+}
+
+class BVHBuilder {
+public:
+  const MXMDInstanceBVH::Item *items;
+  std::vector<Vector> centroids;
+  std::vector<int> order;
+
+  BVHBox RangeBounds(int first, int count) const {
+    BVHBox retVal;
+
+    for (int i = first; i < first + count; i++)
+      retVal.Extend(items[order[i]].bbMin, items[order[i]].bbMax);
+
+    return retVal;
+  }
+
+  // Binned SAH split, reorders range and returns split position.
+  // Returns -1 when range should become a leaf.
+  int Split(int first, int count, const BVHBox &bounds) {
+    if (count <= 1)
+      return -1;
+
+    BVHBox cBounds;
+
+    for (int i = first; i < first + count; i++)
+      cBounds.Extend(centroids[order[i]], centroids[order[i]]);
+
+    int axis = 0;
+
+    for (int c = 1; c < 3; c++)
+      if (cBounds.bbMax[c] - cBounds.bbMin[c] >
+          cBounds.bbMax[axis] - cBounds.bbMin[axis])
+        axis = c;
+
+    const float axisMin = cBounds.bbMin[axis];
+    const float extent = cBounds.bbMax[axis] - axisMin;
+
+    if (extent <= 0.0f)
+      return count > bvhMaxLeafItems ? first + count / 2 : -1;
+
+    BVHBox bins[bvhNumBins];
+    int binCounts[bvhNumBins] = {};
+    const float binScale = bvhNumBins / extent;
+
+    auto BinIndex = [&](int item) {
+      const int bin =
+          static_cast<int>((centroids[item][axis] - axisMin) * binScale);
+      return std::min(bin, bvhNumBins - 1);
+    };
+
+    for (int i = first; i < first + count; i++) {
+      const int item = order[i];
+      const int bin = BinIndex(item);
+      bins[bin].Extend(items[item].bbMin, items[item].bbMax);
+      binCounts[bin]++;
+    }
+
+    float rightAreas[bvhNumBins];
+    int rightCounts[bvhNumBins];
+    BVHBox accum;
+    int accumCount = 0;
+
+    for (int b = bvhNumBins - 1; b > 0; b--) {
+      accum.Extend(bins[b].bbMin, bins[b].bbMax);
+      accumCount += binCounts[b];
+      rightAreas[b] = accum.Area();
+      rightCounts[b] = accumCount;
+    }
+
+    const float parentArea = std::max(bounds.Area(), FLT_MIN);
+    float bestCost = FLT_MAX;
+    int bestBin = -1;
+    accum = BVHBox();
+    accumCount = 0;
+
+    for (int b = 1; b < bvhNumBins; b++) {
+      accum.Extend(bins[b - 1].bbMin, bins[b - 1].bbMax);
+      accumCount += binCounts[b - 1];
+
+      if (!accumCount || !rightCounts[b])
+        continue;
+
+      const float cost = 1.0f + (accum.Area() * accumCount +
+                                 rightAreas[b] * rightCounts[b]) /
+                                    parentArea;
+
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestBin = b;
+      }
+    }
+
+    if (count <= bvhMaxLeafItems && bestCost >= count)
+      return -1;
+
+    int *rangeBegin = order.data() + first;
+    int *rangeEnd = rangeBegin + count;
+    int *mid = rangeBegin;
+
+    if (bestBin > 0)
+      mid = std::partition(rangeBegin, rangeEnd,
+                           [&](int item) { return BinIndex(item) < bestBin; });
+
+    if (mid == rangeBegin || mid == rangeEnd) {
+      mid = rangeBegin + count / 2;
+      std::nth_element(rangeBegin, mid, rangeEnd, [&](int a, int b) {
+        return centroids[a][axis] < centroids[b][axis];
+      });
+    }
+
+    return static_cast<int>(mid - order.data());
+  }
+
+  void Build(int first, int count, std::vector<MXMDInstanceBVH::Node> &nodes) {
+    const BVHBox bounds = RangeBounds(first, count);
+    const int nodeIndex = static_cast<int>(nodes.size());
+    MXMDInstanceBVH::Node cNode;
+    cNode.bbMin = bounds.bbMin;
+    cNode.bbMax = bounds.bbMax;
+    cNode.child = first;
+    cNode.numItems = count;
+    nodes.push_back(cNode);
+
+    const int mid = Split(first, count, bounds);
+
+    if (mid < 0)
+      return;
+
+    nodes[nodeIndex].numItems = 0;
+    Build(first, mid - first, nodes);
+    nodes[nodeIndex].child = static_cast<int>(nodes.size());
+    Build(mid, first + count - mid, nodes);
+  }
+};
+
+struct BVHTask {
+  int first, count;
+  std::vector<MXMDInstanceBVH::Node> nodes;
+};
+
+// Upper part of tree, that is split into independent tasks.
+struct BVHTopNode {
+  BVHBox bounds;
+  int left, right, task;
+};
+
+static int BuildTopNodes(BVHBuilder &builder, int first, int count, int depth,
+                         std::vector<BVHTopNode> &tops,
+                         std::vector<BVHTask> &tasks) {
+  BVHTopNode cNode;
+  cNode.bounds = builder.RangeBounds(first, count);
+  cNode.left = cNode.right = cNode.task = -1;
+
+  const int nodeIndex = static_cast<int>(tops.size());
+  tops.push_back(cNode);
+
+  const int mid = depth < bvhMaxTaskDepth && count > bvhMinTaskItems
+                      ? builder.Split(first, count, cNode.bounds)
+                      : -1;
+
+  if (mid < 0) {
+    BVHTask cTask;
+    cTask.first = first;
+    cTask.count = count;
+    tops[nodeIndex].task = static_cast<int>(tasks.size());
+    tasks.push_back(cTask);
+    return nodeIndex;
+  }
+
+  const int left =
+      BuildTopNodes(builder, first, mid - first, depth + 1, tops, tasks);
+  const int right =
+      BuildTopNodes(builder, mid, first + count - mid, depth + 1, tops, tasks);
+  tops[nodeIndex].left = left;
+  tops[nodeIndex].right = right;
+
+  return nodeIndex;
+}
+
+static void EmitTopNode(const std::vector<BVHTopNode> &tops,
+                        const std::vector<BVHTask> &tasks, int topIndex,
+                        std::vector<MXMDInstanceBVH::Node> &nodes) {
+  const BVHTopNode &cTop = tops[topIndex];
+
+  if (cTop.task > -1) {
+    const int offset = static_cast<int>(nodes.size());
+
+    for (auto n : tasks[cTop.task].nodes) {
+      if (!n.numItems)
+        n.child += offset;
+
+      nodes.push_back(n);
+    }
+
+    return;
+  }
+
+  const int nodeIndex = static_cast<int>(nodes.size());
+  MXMDInstanceBVH::Node cNode;
+  cNode.bbMin = cTop.bounds.bbMin;
+  cNode.bbMax = cTop.bounds.bbMax;
+  cNode.child = 0;
+  cNode.numItems = 0;
+  nodes.push_back(cNode);
+
+  EmitTopNode(tops, tasks, cTop.left, nodes);
+  nodes[nodeIndex].child = static_cast<int>(nodes.size());
+  EmitTopNode(tops, tasks, cTop.right, nodes);
+}
+
+struct BVHBuildQueue {
+  int queue;
+  int queueEnd;
+  BVHBuilder *builder;
+  BVHTask *tasks;
+
+  typedef void return_type;
+
+  BVHBuildQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    BVHTask &cTask = tasks[queue];
+    builder->Build(cTask.first, cTask.count, cTask.nodes);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+int MXMDInstanceBVH::Build(MXMD &file) {
+  MXMDModel::Ptr model = file.GetModel();
+  MXMDInstances::Ptr instances = file.GetInstances();
+
+  if (!model || !instances)
+    return 1;
+
+  return Build(*model, *instances);
+}
+
+int MXMDInstanceBVH::Build(const MXMDModel &model,
+                           const MXMDInstances &instances) {
+  nodes.clear();
+  items.clear();
+
+  const int numMeshGroups = model.GetNumMeshGroups();
+  std::vector<BVHBox> groupBounds(numMeshGroups);
+  std::vector<bool> groupValid(numMeshGroups);
+
+  for (int g = 0; g < numMeshGroups; g++)
+    groupValid[g] = model.GetMeshGroup(g)->GetBounds(groupBounds[g].bbMin,
+                                                     groupBounds[g].bbMax);
+
+  const int numInstances = instances.GetNumInstances();
+
+  for (int i = 0; i < numInstances; i++) {
+    const MXMDTransformMatrix &mtx = *instances.GetTransform(i);
+    const int startingGroup = instances.GetStartingGroup(i);
+    const int endGroup = startingGroup + instances.GetNumGroups(i);
+
+    for (int g = startingGroup; g < endGroup; g++) {
+      const int meshGroup = instances.GetMeshGroup(g);
+
+      if (meshGroup < 0 || meshGroup >= numMeshGroups ||
+          !groupValid[meshGroup])
+        continue;
+
+      Item cItem;
+      cItem.id.instance = i;
+      cItem.id.group = g;
+      cItem.id.meshGroup = meshGroup;
+      TransformBounds(mtx, groupBounds[meshGroup].bbMin,
+                      groupBounds[meshGroup].bbMax, cItem.bbMin, cItem.bbMax);
+      items.push_back(cItem);
+    }
+  }
+
+  const int numItems = NumItems();
+
+  if (!numItems)
+    return 0;
+
+  BVHBuilder builder;
+  builder.items = items.data();
+  builder.centroids.resize(numItems);
+  builder.order.resize(numItems);
+
+  for (int i = 0; i < numItems; i++) {
+    builder.centroids[i] = (items[i].bbMin + items[i].bbMax) * 0.5f;
+    builder.order[i] = i;
+  }
+
+  std::vector<BVHTopNode> tops;
+  std::vector<BVHTask> tasks;
+  BuildTopNodes(builder, 0, numItems, 0, tops, tasks);
+
+  BVHBuildQueue buildQue;
+  buildQue.queueEnd = static_cast<int>(tasks.size());
+  buildQue.builder = &builder;
+  buildQue.tasks = tasks.data();
+
+  RunScheduledQueue(buildQue);
+
+  EmitTopNode(tops, tasks, 0, nodes);
+
+  std::vector<Item> sortedItems(numItems);
+
+  for (int i = 0; i < numItems; i++)
+    sortedItems[i] = items[builder.order[i]];
+
+  items.swap(sortedItems);
+
+  return 0;
+}
+
+template <class Overlaps, class Accept>
+static void TraverseBVH(const MXMDInstanceBVH &bvh, Overlaps overlaps,
+                        Accept accept) {
+  if (!bvh.NumNodes())
+    return;
+
+  const MXMDInstanceBVH::Node *nodes = bvh.GetNodes();
+  const MXMDInstanceBVH::Item *items = bvh.GetItems();
+  std::vector<int> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+
+  while (!stack.empty()) {
+    const int nodeIndex = stack.back();
+    const MXMDInstanceBVH::Node &cNode = nodes[nodeIndex];
+    stack.pop_back();
+
+    if (!overlaps(cNode.bbMin, cNode.bbMax))
+      continue;
+
+    if (cNode.numItems) {
+      for (int i = cNode.child; i < cNode.child + cNode.numItems; i++)
+        if (overlaps(items[i].bbMin, items[i].bbMax))
+          accept(items[i]);
+    } else {
+      stack.push_back(cNode.child);
+      stack.push_back(nodeIndex + 1);
+    }
+  }
+}
+
+void MXMDInstanceBVH::QueryBox(const Vector &bbMin, const Vector &bbMax,
+                               std::vector<MXMDInstanceHit> &out) const {
+  TraverseBVH(
+      *this,
+      [&](const Vector &nMin, const Vector &nMax) {
+        return nMin.X <= bbMax.X && nMax.X >= bbMin.X && nMin.Y <= bbMax.Y &&
+               nMax.Y >= bbMin.Y && nMin.Z <= bbMax.Z && nMax.Z >= bbMin.Z;
+      },
+      [&](const Item &item) { out.push_back(item.id); });
+}
+
+void MXMDInstanceBVH::QuerySphere(const Vector &center, float radius,
+                                  std::vector<MXMDInstanceHit> &out) const {
+  const float radiusSq = radius * radius;
+
+  TraverseBVH(
+      *this,
+      [&](const Vector &nMin, const Vector &nMax) {
+        float distSq = 0.0f;
+
+        for (int c = 0; c < 3; c++) {
+          const float closest = std::min(std::max(center[c], nMin[c]), nMax[c]);
+          const float delta = center[c] - closest;
+          distSq += delta * delta;
+        }
+
+        return distSq <= radiusSq;
+      },
+      [&](const Item &item) { out.push_back(item.id); });
+}
+
+void MXMDInstanceBVH::QueryFrustum(const Vector4 *planes, int numPlanes,
+                                   std::vector<MXMDInstanceHit> &out) const {
+  TraverseBVH(
+      *this,
+      [&](const Vector &nMin, const Vector &nMax) {
+        for (int p = 0; p < numPlanes; p++) {
+          const Vector4 &plane = planes[p];
+          // Box corner furthest along plane normal
+          const float dist = plane.X * (plane.X >= 0.0f ? nMax.X : nMin.X) +
+                             plane.Y * (plane.Y >= 0.0f ? nMax.Y : nMin.Y) +
+                             plane.Z * (plane.Z >= 0.0f ? nMax.Z : nMin.Z) +
+                             plane.W;
+
+          if (dist < 0.0f)
+            return false;
+        }
+
+        return true;
+      },
+      [&](const Item &item) { out.push_back(item.id); });
+}
+
+void MXMDInstanceBVH::QueryRay(const Vector &origin, const Vector &direction,
+                               float maxDistance,
+                               std::vector<MXMDInstanceHit> &out) const {
+  const Vector invDir(1.0f / direction.X, 1.0f / direction.Y,
+                      1.0f / direction.Z);
+  float entry = 0.0f;
+
+  auto RayBox = [&](const Vector &nMin, const Vector &nMax) {
+    float tNear = 0.0f;
+    float tFar = maxDistance;
+
+    for (int c = 0; c < 3; c++) {
+      float t0 = (nMin[c] - origin[c]) * invDir[c];
+      float t1 = (nMax[c] - origin[c]) * invDir[c];
+
+      if (t0 > t1)
+        std::swap(t0, t1);
+
+      // Comparisons are false for NaN, keeps ray parallel to slab valid
+      if (t0 > tNear)
+        tNear = t0;
+      if (t1 < tFar)
+        tFar = t1;
+
+      if (tNear > tFar)
+        return false;
+    }
+
+    entry = tNear;
+    return true;
+  };
+
+  std::vector<std::pair<float, MXMDInstanceHit>> hits;
+
+  TraverseBVH(*this, RayBox, [&](const Item &item) {
+    hits.push_back(std::make_pair(entry, item.id));
+  });
+
+  std::stable_sort(hits.begin(), hits.end(),
+                   [](const std::pair<float, MXMDInstanceHit> &a,
+                      const std::pair<float, MXMDInstanceHit> &b) {
+                     return a.first < b.first;
+                   });
+
+  for (auto &h : hits)
+    out.push_back(h.second);
+}
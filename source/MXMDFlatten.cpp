@@ -0,0 +1,354 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MXMDFlatten.h"
+#include "XenoLibScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+// rows[3] is translation, normalize is used for normal streams.
+static void TransformStream(const std::vector<float> *input, int numVertices,
+                            const float rows[4][3], bool normalize,
+                            Vector *output) {
+  __m128 vRows[4][3];
+
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 3; c++)
+      vRows[r][c] = _mm_set1_ps(rows[r][c]);
+
+  const float *inX = input[0].data();
+  const float *inY = input[1].data();
+  const float *inZ = input[2].data();
+  const int numVectorized = numVertices & ~3;
+  alignas(16) float result[3][4];
+
+  for (int v = 0; v < numVectorized; v += 4) {
+    const __m128 x = _mm_loadu_ps(inX + v);
+    const __m128 y = _mm_loadu_ps(inY + v);
+    const __m128 z = _mm_loadu_ps(inZ + v);
+    __m128 out[3];
+
+    for (int c = 0; c < 3; c++)
+      out[c] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(x, vRows[0][c]), _mm_mul_ps(y, vRows[1][c])),
+          _mm_add_ps(_mm_mul_ps(z, vRows[2][c]), vRows[3][c]));
+
+    if (normalize) {
+      const __m128 length2 = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(out[0], out[0]), _mm_mul_ps(out[1], out[1])),
+          _mm_mul_ps(out[2], out[2]));
+      const __m128 valid = _mm_cmpgt_ps(length2, _mm_setzero_ps());
+      const __m128 scale = _mm_and_ps(
+          valid, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length2)));
+
+      for (int c = 0; c < 3; c++)
+        out[c] = _mm_mul_ps(out[c], scale);
+    }
+
+    for (int c = 0; c < 3; c++)
+      _mm_store_ps(result[c], out[c]);
+
+    for (int i = 0; i < 4; i++)
+      output[v + i] = Vector(result[0][i], result[1][i], result[2][i]);
+  }
+
+  for (int v = numVectorized; v < numVertices; v++) {
+    Vector &out = output[v];
+
+    for (int c = 0; c < 3; c++)
+      out[c] = inX[v] * rows[0][c] + inY[v] * rows[1][c] +
+               inZ[v] * rows[2][c] + rows[3][c];
+
+    if (normalize) {
+      const float length =
+          std::sqrt(out.X * out.X + out.Y * out.Y + out.Z * out.Z);
+
+      if (length > 0.0f)
+        out = out * (1.0f / length);
+    }
+  }
+}
+
+static void DecodeSource(const MXMDGeomBuffers &geometry,
+                         MXMDInstanceFlattener::Source &source) {
+  if (source.vertexBuffer < 0 ||
+      source.vertexBuffer >= geometry.GetNumVertexBuffers())
+    return;
+
+  MXMDVertexBuffer::Ptr buffer = geometry.GetVertexBuffer(source.vertexBuffer);
+
+  if (!buffer)
+    return;
+
+  MXMDVertexBuffer::DescriptorCollection descs = buffer->GetDescriptors();
+  MXMDVertexDescriptor *positions = nullptr, *normals = nullptr;
+
+  for (auto &d : descs)
+    switch (d->Type()) {
+    case MXMD_POSITION:
+      positions = d.get();
+      break;
+    case MXMD_NORMAL:
+    case MXMD_NORMAL2:
+    case MXMD_NORMAL32:
+      if (!normals)
+        normals = d.get();
+      break;
+    default:
+      break;
+    }
+
+  if (!positions)
+    return;
+
+  const int numVertices = buffer->NumVertices();
+
+  for (int c = 0; c < 3; c++) {
+    source.positions[c].resize(numVertices);
+    source.normals[c].resize(numVertices);
+  }
+
+  for (int v = 0; v < numVertices; v++) {
+    Vector cPosition, cNormal;
+    positions->Evaluate(v, &cPosition);
+
+    if (normals)
+      normals->Evaluate(v, &cNormal);
+
+    for (int c = 0; c < 3; c++) {
+      source.positions[c][v] = cPosition[c];
+      source.normals[c][v] = cNormal[c];
+    }
+  }
+
+  source.numVertices = numVertices;
+}
+
+// Every queue item decodes all sources of single mesh group.
+struct FlattenDecodeQueue {
+  int queue;
+  int queueEnd;
+  MXMD *file;
+  MXMDInstanceFlattener::Source *sources;
+  const int *firstSources;
+  const int *numSources;
+
+  typedef void return_type;
+
+  FlattenDecodeQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    MXMDInstanceFlattener::Source *groupSources =
+        sources + firstSources[queue];
+    MXMDGeomBuffers::Ptr geometry =
+        file->GetGeometry(groupSources->meshGroup);
+
+    if (!geometry)
+      return;
+
+    for (int s = 0; s < numSources[queue]; s++)
+      DecodeSource(*geometry, groupSources[s]);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+int MXMDInstanceFlattener::Plan(MXMD &file, const MXMDInstanceHit *hits,
+                                int numHits) {
+  sources.clear();
+  ranges.clear();
+  transforms.clear();
+  numVertices = 0;
+
+  MXMDModel::Ptr model = file.GetModel();
+  MXMDInstances::Ptr instances = file.GetInstances();
+
+  if (!model || !instances)
+    return 1;
+
+  const int numInstances = instances->GetNumInstances();
+  transforms.resize(numInstances);
+
+  for (int i = 0; i < numInstances; i++)
+    transforms[i] = *instances->GetTransform(i);
+
+  std::vector<MXMDInstanceHit> allHits;
+
+  if (!hits) {
+    for (int i = 0; i < numInstances; i++) {
+      const int startingGroup = instances->GetStartingGroup(i);
+      const int endGroup = startingGroup + instances->GetNumGroups(i);
+
+      for (int g = startingGroup; g < endGroup; g++) {
+        MXMDInstanceHit cHit;
+        cHit.instance = i;
+        cHit.group = g;
+        cHit.meshGroup = instances->GetMeshGroup(g);
+        allHits.push_back(cHit);
+      }
+    }
+
+    hits = allHits.data();
+    numHits = static_cast<int>(allHits.size());
+  }
+
+  const int numMeshGroups = model->GetNumMeshGroups();
+  std::vector<int> groupSources(numMeshGroups, -1);
+  std::vector<int> firstSources, numSources;
+
+  for (int h = 0; h < numHits; h++) {
+    const int meshGroup = hits[h].meshGroup;
+
+    if (meshGroup < 0 || meshGroup >= numMeshGroups ||
+        groupSources[meshGroup] >= 0)
+      continue;
+
+    MXMDMeshGroup::Ptr cGroup = model->GetMeshGroup(meshGroup);
+    const int numMeshObjects = cGroup->GetNumMeshObjects();
+    std::vector<int> bufferIDs(numMeshObjects);
+
+    for (int m = 0; m < numMeshObjects; m++)
+      bufferIDs[m] = cGroup->GetMeshObject(m)->GetBufferID();
+
+    std::sort(bufferIDs.begin(), bufferIDs.end());
+    bufferIDs.erase(std::unique(bufferIDs.begin(), bufferIDs.end()),
+                    bufferIDs.end());
+
+    groupSources[meshGroup] = static_cast<int>(firstSources.size());
+    firstSources.push_back(static_cast<int>(sources.size()));
+    numSources.push_back(static_cast<int>(bufferIDs.size()));
+
+    for (int b : bufferIDs) {
+      Source cSource;
+      cSource.meshGroup = meshGroup;
+      cSource.vertexBuffer = b;
+      cSource.numVertices = 0;
+      sources.push_back(std::move(cSource));
+    }
+  }
+
+  FlattenDecodeQueue decodeQue;
+  decodeQue.file = &file;
+  decodeQue.sources = sources.data();
+  decodeQue.firstSources = firstSources.data();
+  decodeQue.numSources = numSources.data();
+  decodeQue.queueEnd = static_cast<int>(firstSources.size());
+
+  RunScheduledQueue(decodeQue);
+
+  for (int h = 0; h < numHits; h++) {
+    const MXMDInstanceHit &cHit = hits[h];
+
+    if (cHit.instance < 0 || cHit.instance >= numInstances ||
+        cHit.meshGroup < 0 || cHit.meshGroup >= numMeshGroups)
+      continue;
+
+    const int groupID = groupSources[cHit.meshGroup];
+    const int firstSource = firstSources[groupID];
+    const int endSource = firstSource + numSources[groupID];
+
+    for (int s = firstSource; s < endSource; s++) {
+      if (!sources[s].numVertices)
+        continue;
+
+      Range cRange;
+      cRange.id = cHit;
+      cRange.source = s;
+      cRange.firstVertex = numVertices;
+      cRange.numVertices = sources[s].numVertices;
+      ranges.push_back(cRange);
+      numVertices += cRange.numVertices;
+    }
+  }
+
+  return 0;
+}
+
+struct FlattenQueue {
+  int queue;
+  int queueEnd;
+  const MXMDInstanceFlattener::Range *ranges;
+  const MXMDInstanceFlattener *flattener;
+  const MXMDTransformMatrix *transforms;
+  Vector *positions;
+  Vector *normals;
+
+  typedef void return_type;
+
+  FlattenQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    const MXMDInstanceFlattener::Range &cRange = ranges[queue];
+    const MXMDInstanceFlattener::Source &cSource =
+        flattener->GetSource(cRange.source);
+    const MXMDTransformMatrix &mtx = transforms[cRange.id.instance];
+    float rows[4][3];
+
+    for (int r = 0; r < 4; r++)
+      for (int c = 0; c < 3; c++)
+        rows[r][c] = mtx.m[r][c];
+
+    TransformStream(cSource.positions, cSource.numVertices, rows, false,
+                    positions + cRange.firstVertex);
+
+    if (!normals)
+      return;
+
+    // Cofactor rows are inverse transpose scaled by determinant,
+    // sign of determinant keeps normals facing outwards.
+    float normalRows[4][3] = {};
+
+    for (int r = 0; r < 3; r++) {
+      const float *a = rows[(r + 1) % 3];
+      const float *b = rows[(r + 2) % 3];
+      normalRows[r][0] = a[1] * b[2] - a[2] * b[1];
+      normalRows[r][1] = a[2] * b[0] - a[0] * b[2];
+      normalRows[r][2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    const float determinant = rows[0][0] * normalRows[0][0] +
+                              rows[0][1] * normalRows[0][1] +
+                              rows[0][2] * normalRows[0][2];
+
+    if (determinant < 0.0f)
+      for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+          normalRows[r][c] = -normalRows[r][c];
+
+    TransformStream(cSource.normals, cSource.numVertices, normalRows, true,
+                    normals + cRange.firstVertex);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+void MXMDInstanceFlattener::Flatten(Vector *positions, Vector *normals) const {
+  FlattenQueue flattenQue;
+  flattenQue.ranges = ranges.data();
+  flattenQue.flattener = this;
+  flattenQue.transforms = transforms.data();
+  flattenQue.positions = positions;
+  flattenQue.normals = normals;
+  flattenQue.queueEnd = NumRanges();
+
+  RunScheduledQueue(flattenQue);
+}
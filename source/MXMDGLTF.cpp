@@ -0,0 +1,1277 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MXMDGLTF.h"
+#include "MXMDMorph.h"
+#include "datas/esstring.h"
+#include "datas/masterprinter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <unordered_map>
+
+static const int glbMagic = CompileFourCC("glTF");
+static const int glbVersion = 2;
+static const int glbChunkJSON = CompileFourCC("JSON");
+static const int glbChunkBIN = CompileFourCC("BIN\0");
+
+enum GLTFComponentType {
+  GLTF_BYTE = 5120,
+  GLTF_UNSIGNED_BYTE,
+  GLTF_SHORT,
+  GLTF_UNSIGNED_SHORT,
+  GLTF_UNSIGNED_INT = 5125,
+  GLTF_FLOAT
+};
+
+static const int gltfArrayBuffer = 34962;
+static const int gltfElementArrayBuffer = 34963;
+static const int gltfTriangles = 4;
+
+// Fills whole view while binary chunk is written.
+typedef std::function<void(char *)> GLTFFill;
+
+// Either source or fill is used.
+struct GLTFView {
+  size_t offset;
+  size_t size;
+  int stride;
+  int target;
+  const char *source;
+  GLTFFill fill;
+};
+
+struct GLTFAccessor {
+  int view;
+  size_t offset;
+  int componentType;
+  bool normalized;
+  int count;
+  const char *type;
+  bool hasBounds;
+  float bbMin[3], bbMax[3];
+  // Sparse values are UNSIGNED_INT indices and values of accessor format
+  int numSparse;
+  int sparseIndices, sparseValues;
+
+  GLTFAccessor(int inView, int inComponentType, int inCount,
+               const char *inType)
+      : view(inView), offset(0), componentType(inComponentType),
+        normalized(false), count(inCount), type(inType), hasBounds(false),
+        bbMin(), bbMax(), numSparse(0), sparseIndices(-1), sparseValues(-1) {}
+
+  void SetBounds(const float *input, int numItems) {
+    hasBounds = true;
+
+    for (int c = 0; c < 3; c++) {
+      bbMin[c] = numItems ? input[c] : 0.0f;
+      bbMax[c] = bbMin[c];
+    }
+
+    for (int i = 1; i < numItems; i++)
+      for (int c = 0; c < 3; c++) {
+        bbMin[c] = std::min(bbMin[c], input[i * 3 + c]);
+        bbMax[c] = std::max(bbMax[c], input[i * 3 + c]);
+      }
+  }
+};
+
+// Format of attribute referenced in place, transcoded attributes are
+// written as numComponents floats.
+struct GLTFAttributeFormat {
+  const char *semantic;
+  int componentType;
+  bool normalized;
+  const char *type;
+  int numComponents;
+  int size;
+};
+
+static bool GetAttributeFormat(MXMDVertexDescriptorType type,
+                               GLTFAttributeFormat &out) {
+  static const char *const uvSemantics[] = {"TEXCOORD_0", "TEXCOORD_1",
+                                            "TEXCOORD_2"};
+
+  switch (type) {
+  case MXMD_POSITION:
+    out = {"POSITION", GLTF_FLOAT, false, "VEC3", 3, 12};
+    return true;
+  case MXMD_NORMAL32:
+    out = {"NORMAL", GLTF_FLOAT, false, "VEC3", 3, 12};
+    return true;
+  case MXMD_NORMAL:
+  case MXMD_NORMAL2:
+    out = {"NORMAL", GLTF_BYTE, true, "VEC3", 3, 3};
+    return true;
+  case MXMD_UV1:
+  case MXMD_UV2:
+  case MXMD_UV3:
+    out = {uvSemantics[type - MXMD_UV1], GLTF_FLOAT, false, "VEC2", 2, 8};
+    return true;
+  case MXMD_VERTEXCOLOR:
+    out = {"COLOR_0", GLTF_UNSIGNED_BYTE, true, "VEC4", 4, 4};
+    return true;
+  default:
+    return false;
+  }
+}
+
+static const MXMDTransformMatrix gltfIdentity = {{
+    Vector4(1.0f, 0.0f, 0.0f, 0.0f),
+    Vector4(0.0f, 1.0f, 0.0f, 0.0f),
+    Vector4(0.0f, 0.0f, 1.0f, 0.0f),
+    Vector4(0.0f, 0.0f, 0.0f, 1.0f),
+}};
+
+// Affine inverse, row vector convention.
+static MXMDTransformMatrix InverseTransform(const MXMDTransformMatrix &mtx) {
+  float cofactors[3][3];
+
+  for (int r = 0; r < 3; r++) {
+    const Vector4 &a = mtx.m[(r + 1) % 3];
+    const Vector4 &b = mtx.m[(r + 2) % 3];
+    cofactors[r][0] = a.Y * b.Z - a.Z * b.Y;
+    cofactors[r][1] = a.Z * b.X - a.X * b.Z;
+    cofactors[r][2] = a.X * b.Y - a.Y * b.X;
+  }
+
+  const float determinant = mtx.m[0].X * cofactors[0][0] +
+                            mtx.m[0].Y * cofactors[0][1] +
+                            mtx.m[0].Z * cofactors[0][2];
+
+  if (std::fabs(determinant) < 1e-12f)
+    return gltfIdentity;
+
+  const float invDeterminant = 1.0f / determinant;
+  MXMDTransformMatrix result = gltfIdentity;
+
+  // Inverse is transposed cofactor matrix
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      result.m[r][c] = cofactors[c][r] * invDeterminant;
+
+  for (int c = 0; c < 3; c++)
+    result.m[3][c] = -(mtx.m[3].X * result.m[0][c] +
+                       mtx.m[3].Y * result.m[1][c] +
+                       mtx.m[3].Z * result.m[2][c]);
+
+  return result;
+}
+
+static void AppendFloat(std::string &out, float value) {
+  char buffer[32];
+
+  if (!std::isfinite(value))
+    value = 0.0f;
+
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  out.append(buffer);
+}
+
+static void AppendInt(std::string &out, size_t value) {
+  out.append(std::to_string(value));
+}
+
+static void AppendString(std::string &out, const char *str) {
+  out.push_back('"');
+
+  for (; *str; str++) {
+    const unsigned char c = *str;
+
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (c < 0x20) {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      out.append(buffer);
+    } else
+      out.push_back(c);
+  }
+
+  out.push_back('"');
+}
+
+static void AppendMatrix(std::string &out, const MXMDTransformMatrix &mtx) {
+  // Row major row vector matrix has the same layout as
+  // column major column vector one.
+  const float *values = reinterpret_cast<const float *>(&mtx);
+  out.append("\"matrix\":[");
+
+  for (int i = 0; i < 16; i++) {
+    if (i)
+      out.push_back(',');
+
+    AppendFloat(out, values[i]);
+  }
+
+  out.push_back(']');
+}
+
+struct GLTFVertexBuffer {
+  int numVertices;
+  bool hasNormals;
+  // semantic, accessor
+  std::vector<std::pair<const char *, int>> attributes;
+  std::shared_ptr<MXMDVertexDescriptor> weightIDs;
+  // skin flags, JOINTS_0 and WEIGHTS_0 accessors
+  std::map<int, std::pair<int, int>> skins;
+  bool morphsPlanned;
+  std::vector<int> morphNames;
+  // POSITION and NORMAL accessors, NORMAL is -1 when not available
+  std::vector<std::pair<int, int>> morphTargets;
+
+  GLTFVertexBuffer()
+      : numVertices(0), hasNormals(false), morphsPlanned(false) {}
+};
+
+class GLTFExporter {
+  MXMD &file;
+  MXMDGLTFParams params;
+  std::vector<GLTFView> views;
+  std::vector<GLTFAccessor> accessors;
+  size_t binSize;
+  bool quantized;
+  std::map<int, std::shared_ptr<MXMDGeomBuffers>> geometries;
+  std::map<std::pair<int, int>, GLTFVertexBuffer> vertexBuffers;
+  std::map<std::pair<int, int>, int> faceAccessors;
+  std::map<int, int> zeroAccessors;
+  std::map<int, std::pair<int, int>> rigidSkins;
+  std::vector<std::shared_ptr<MXMDMorphSet>> morphSets;
+  std::vector<MXMDTransformMatrix> inverseBinds;
+
+  int AddView(size_t size, int stride, int target, const char *source,
+              GLTFFill fill = nullptr);
+  int AddAccessor(const GLTFAccessor &accessor);
+  MXMDGeomBuffers *GetGeometry(int group);
+  GLTFVertexBuffer &PlanVertexBuffer(int group, int id);
+  int PlanIndices(int group, int id);
+  std::pair<int, int> PlanSkin(int group, GLTFVertexBuffer &cBuffer,
+                               int skinFlags);
+  void PlanMorphs(int group, int id, GLTFVertexBuffer &cBuffer);
+  int ZeroAccessor(int count);
+  std::pair<int, int> RigidSkin(int count);
+
+  void AppendViews(std::string &out) const;
+  void AppendAccessors(std::string &out) const;
+
+public:
+  GLTFExporter(MXMD &inFile, MXMDGLTFParams inParams)
+      : file(inFile), params(inParams), binSize(0), quantized(false) {}
+
+  int Plan(std::string &json);
+  int WriteBinary(std::ostream &str) const;
+  size_t BinarySize() const { return binSize; }
+};
+
+int GLTFExporter::AddView(size_t size, int stride, int target,
+                          const char *source, GLTFFill fill) {
+  GLTFView cView;
+  cView.offset = (binSize + 3) & ~static_cast<size_t>(3);
+  cView.size = size;
+  cView.stride = stride;
+  cView.target = target;
+  cView.source = source;
+  cView.fill = fill;
+  binSize = cView.offset + size;
+  views.push_back(cView);
+
+  return static_cast<int>(views.size()) - 1;
+}
+
+int GLTFExporter::AddAccessor(const GLTFAccessor &accessor) {
+  accessors.push_back(accessor);
+  return static_cast<int>(accessors.size()) - 1;
+}
+
+MXMDGeomBuffers *GLTFExporter::GetGeometry(int group) {
+  auto found = geometries.find(group);
+
+  if (found != geometries.end())
+    return found->second.get();
+
+  std::shared_ptr<MXMDGeomBuffers> &geometry = geometries[group];
+  geometry = std::shared_ptr<MXMDGeomBuffers>(file.GetGeometry(group));
+
+  return geometry.get();
+}
+
+// Attributes sharing source vertex buffer are referenced through single
+// interleaved view when their format and alignment allows it.
+GLTFVertexBuffer &GLTFExporter::PlanVertexBuffer(int group, int id) {
+  const std::pair<int, int> key(group, id);
+  auto found = vertexBuffers.find(key);
+
+  if (found != vertexBuffers.end())
+    return found->second;
+
+  GLTFVertexBuffer &cBuffer = vertexBuffers[key];
+  MXMDGeomBuffers *geometry = GetGeometry(group);
+
+  if (!geometry || id < 0 || id >= geometry->GetNumVertexBuffers())
+    return cBuffer;
+
+  MXMDVertexBuffer::Ptr vBuffer = geometry->GetVertexBuffer(id);
+
+  if (!vBuffer || vBuffer->NumVertices() <= 0)
+    return cBuffer;
+
+  const int numVertices = vBuffer->NumVertices();
+  MXMDVertexBuffer::DescriptorCollection descs = vBuffer->GetDescriptors();
+
+  struct Attribute {
+    std::shared_ptr<MXMDVertexDescriptor> desc;
+    GLTFAttributeFormat format;
+    bool direct;
+  };
+
+  std::vector<Attribute> attributes;
+  const char *base = nullptr;
+
+  for (auto &d : descs) {
+    if (d->Type() == MXMD_WEIGHTID) {
+      cBuffer.weightIDs.reset(d.release());
+      continue;
+    }
+
+    Attribute cAttribute;
+
+    if (!GetAttributeFormat(d->Type(), cAttribute.format))
+      continue;
+
+    bool used = false;
+
+    for (auto &a : attributes)
+      used |= !strcmp(a.format.semantic, cAttribute.format.semantic);
+
+    if (used)
+      continue;
+
+    const char *raw = d->GetRawBuffer();
+    const int stride = d->GetStride();
+
+    cAttribute.direct = raw && !(stride & 3) && stride >= 4 &&
+                        stride <= 252 &&
+                        (cAttribute.format.componentType != GLTF_BYTE ||
+                         !params.noQuantization);
+
+    if (cAttribute.direct && (!base || raw < base))
+      base = raw;
+
+    cAttribute.desc.reset(d.release());
+    attributes.push_back(cAttribute);
+  }
+
+  int directView = -1;
+  int directStride = 0;
+  size_t directEnd = 0;
+
+  // Vertex attributes must be 4 byte aligned within view
+  for (auto &a : attributes) {
+    if (!a.direct)
+      continue;
+
+    const size_t offset = a.desc->GetRawBuffer() - base;
+
+    if (offset & 3) {
+      a.direct = false;
+      continue;
+    }
+
+    directStride = a.desc->GetStride();
+    directEnd = std::max(directEnd, offset + a.format.size);
+  }
+
+  if (directEnd)
+    directView = AddView(directStride * (numVertices - 1) + directEnd,
+                         directStride, gltfArrayBuffer, base);
+
+  cBuffer.numVertices = numVertices;
+
+  for (auto &a : attributes) {
+    const bool direct = a.direct;
+    const int numComponents = a.format.numComponents;
+    int view = directView;
+
+    if (!direct) {
+      std::shared_ptr<MXMDVertexDescriptor> desc = a.desc;
+      view = AddView(numVertices * numComponents * sizeof(float), 0,
+                     gltfArrayBuffer, nullptr,
+                     [desc, numVertices, numComponents](char *output) {
+                       float *out = reinterpret_cast<float *>(output);
+                       Vector4 value;
+
+                       for (int v = 0; v < numVertices; v++) {
+                         desc->Evaluate(v, &value);
+                         memcpy(out + v * numComponents, &value,
+                                numComponents * sizeof(float));
+                       }
+                     });
+    }
+
+    GLTFAccessor cAccessor(view, direct ? a.format.componentType : GLTF_FLOAT,
+                           numVertices, a.format.type);
+
+    if (direct) {
+      cAccessor.offset = a.desc->GetRawBuffer() - base;
+      cAccessor.normalized = a.format.normalized;
+      quantized |= a.format.componentType == GLTF_BYTE;
+    }
+
+    if (a.desc->Type() == MXMD_POSITION) {
+      std::vector<Vector> positions(numVertices);
+
+      for (int v = 0; v < numVertices; v++)
+        a.desc->Evaluate(v, &positions[v]);
+
+      cAccessor.SetBounds(reinterpret_cast<const float *>(positions.data()),
+                          numVertices);
+    }
+
+    cBuffer.hasNormals |= !strcmp(a.format.semantic, "NORMAL");
+    cBuffer.attributes.push_back(
+        std::make_pair(a.format.semantic, AddAccessor(cAccessor)));
+  }
+
+  return cBuffer;
+}
+
+int GLTFExporter::PlanIndices(int group, int id) {
+  const std::pair<int, int> key(group, id);
+  auto found = faceAccessors.find(key);
+
+  if (found != faceAccessors.end())
+    return found->second;
+
+  int &accessor = faceAccessors[key];
+  accessor = -1;
+  MXMDGeomBuffers *geometry = GetGeometry(group);
+
+  if (!geometry || id < 0 || id >= geometry->GetNumFaceBuffers())
+    return accessor;
+
+  MXMDFaceBuffer::Ptr faces = geometry->GetFaceBuffer(id);
+
+  if (!faces || faces->GetNumIndices() <= 0)
+    return accessor;
+
+  const int numIndices = faces->GetNumIndices();
+  const int view = AddView(numIndices * sizeof(ushort), 0,
+                           gltfElementArrayBuffer,
+                           reinterpret_cast<const char *>(faces->GetBuffer()));
+  accessor = AddAccessor(
+      GLTFAccessor(view, GLTF_UNSIGNED_SHORT, numIndices, "SCALAR"));
+
+  return accessor;
+}
+
+// Vertices reference resolved weights through weight ids.
+std::pair<int, int> GLTFExporter::PlanSkin(int group,
+                                           GLTFVertexBuffer &cBuffer,
+                                           int skinFlags) {
+  if (!cBuffer.weightIDs)
+    return std::make_pair(-1, -1);
+
+  auto found = cBuffer.skins.find(skinFlags);
+
+  if (found != cBuffer.skins.end())
+    return found->second;
+
+  std::pair<int, int> &accessors = cBuffer.skins[skinFlags];
+  accessors = std::make_pair(-1, -1);
+  const MXMDVertexWeightSpan weights = file.GetVertexWeights(skinFlags, group);
+
+  if (weights.Empty())
+    return accessors;
+
+  const std::shared_ptr<MXMDVertexDescriptor> weightIDs = cBuffer.weightIDs;
+  const int numVertices = cBuffer.numVertices;
+  const auto getWeight = [weightIDs, weights](int v) {
+    ushort weightID = 0;
+    weightIDs->Evaluate(v, &weightID);
+
+    return weightID < weights.Size() ? weights[weightID] : MXMDVertexWeight();
+  };
+
+  const int jointsView =
+      AddView(numVertices * sizeof(UCVector4), 0, gltfArrayBuffer, nullptr,
+              [numVertices, getWeight](char *output) {
+                UCVector4 *out = reinterpret_cast<UCVector4 *>(output);
+
+                for (int v = 0; v < numVertices; v++)
+                  out[v] = getWeight(v).boneids;
+              });
+  const int weightsView =
+      AddView(numVertices * sizeof(Vector4), 0, gltfArrayBuffer, nullptr,
+              [numVertices, getWeight](char *output) {
+                Vector4 *out = reinterpret_cast<Vector4 *>(output);
+
+                for (int v = 0; v < numVertices; v++)
+                  out[v] = getWeight(v).weights;
+              });
+
+  accessors.first = AddAccessor(
+      GLTFAccessor(jointsView, GLTF_UNSIGNED_BYTE, numVertices, "VEC4"));
+  accessors.second = AddAccessor(
+      GLTFAccessor(weightsView, GLTF_FLOAT, numVertices, "VEC4"));
+
+  return accessors;
+}
+
+// Accessor without view, initialized with zeros.
+int GLTFExporter::ZeroAccessor(int count) {
+  auto found = zeroAccessors.find(count);
+
+  if (found != zeroAccessors.end())
+    return found->second;
+
+  GLTFAccessor cAccessor(-1, GLTF_FLOAT, count, "VEC3");
+  cAccessor.SetBounds(nullptr, 0);
+
+  return zeroAccessors[count] = AddAccessor(cAccessor);
+}
+
+// Binds unweighted vertices fully to first joint, so they stay in place in
+// bind pose.
+std::pair<int, int> GLTFExporter::RigidSkin(int count) {
+  auto found = rigidSkins.find(count);
+
+  if (found != rigidSkins.end())
+    return found->second;
+
+  const int jointsView =
+      AddView(count * sizeof(UCVector4), 0, gltfArrayBuffer, nullptr,
+              [count](char *output) {
+                memset(output, 0, count * sizeof(UCVector4));
+              });
+  const int weightsView =
+      AddView(count * sizeof(Vector4), 0, gltfArrayBuffer, nullptr,
+              [count](char *output) {
+                Vector4 *out = reinterpret_cast<Vector4 *>(output);
+
+                for (int v = 0; v < count; v++)
+                  out[v] = Vector4(1.0f, 0.0f, 0.0f, 0.0f);
+              });
+
+  std::pair<int, int> &accessors = rigidSkins[count];
+  accessors.first = AddAccessor(
+      GLTFAccessor(jointsView, GLTF_UNSIGNED_BYTE, count, "VEC4"));
+  accessors.second =
+      AddAccessor(GLTFAccessor(weightsView, GLTF_FLOAT, count, "VEC4"));
+
+  return accessors;
+}
+
+// Deltas are written as sparse accessors over zero initialized data.
+void GLTFExporter::PlanMorphs(int group, int id, GLTFVertexBuffer &cBuffer) {
+  if (cBuffer.morphsPlanned)
+    return;
+
+  cBuffer.morphsPlanned = true;
+  MXMDGeomBuffers *geometry = GetGeometry(group);
+  MXMDMorphTargets::Ptr morphs =
+      geometry ? geometry->GetVertexBufferMorphTargets(id) : nullptr;
+
+  if (!morphs)
+    return;
+
+  std::shared_ptr<MXMDMorphSet> morphSet(new MXMDMorphSet);
+
+  if (morphSet->Decode(*morphs))
+    return;
+
+  morphSets.push_back(morphSet);
+
+  const int numVertices = cBuffer.numVertices;
+  const int numTargets = morphSet->NumTargets();
+
+  for (int t = 0; t < numTargets; t++) {
+    const MXMDMorphSet::Target &cTarget = morphSet->GetTarget(t);
+    const int numItems = static_cast<int>(
+        std::lower_bound(cTarget.vertexIDs.begin(), cTarget.vertexIDs.end(),
+                         numVertices) -
+        cTarget.vertexIDs.begin());
+
+    cBuffer.morphNames.push_back(cTarget.nameID);
+
+    if (!numItems) {
+      cBuffer.morphTargets.push_back(std::make_pair(
+          ZeroAccessor(numVertices),
+          cBuffer.hasNormals ? ZeroAccessor(numVertices) : -1));
+      continue;
+    }
+
+    const int indicesView = AddView(
+        numItems * sizeof(int), 0, 0,
+        reinterpret_cast<const char *>(cTarget.vertexIDs.data()));
+
+    const auto addDeltas = [&](const std::vector<float> *deltas) {
+      const int view = AddView(
+          numItems * sizeof(Vector), 0, 0, nullptr,
+          [deltas, numItems](char *output) {
+            float *out = reinterpret_cast<float *>(output);
+
+            for (int i = 0; i < numItems; i++)
+              for (int c = 0; c < 3; c++)
+                out[i * 3 + c] = deltas[c][i];
+          });
+
+      std::vector<float> interleaved(numItems * 3);
+
+      for (int i = 0; i < numItems; i++)
+        for (int c = 0; c < 3; c++)
+          interleaved[i * 3 + c] = deltas[c][i];
+
+      GLTFAccessor cAccessor(-1, GLTF_FLOAT, numVertices, "VEC3");
+      cAccessor.SetBounds(interleaved.data(), numItems);
+
+      // Untouched vertices keep zero delta
+      if (numItems < numVertices)
+        for (int c = 0; c < 3; c++) {
+          cAccessor.bbMin[c] = std::min(cAccessor.bbMin[c], 0.0f);
+          cAccessor.bbMax[c] = std::max(cAccessor.bbMax[c], 0.0f);
+        }
+
+      cAccessor.numSparse = numItems;
+      cAccessor.sparseIndices = indicesView;
+      cAccessor.sparseValues = view;
+
+      return AddAccessor(cAccessor);
+    };
+
+    const int positions = addDeltas(cTarget.positions);
+    const int normals = cBuffer.hasNormals ? addDeltas(cTarget.normals) : -1;
+    cBuffer.morphTargets.push_back(std::make_pair(positions, normals));
+  }
+}
+
+void GLTFExporter::AppendViews(std::string &out) const {
+  out.append("\"bufferViews\":[");
+
+  for (size_t v = 0; v < views.size(); v++) {
+    const GLTFView &cView = views[v];
+
+    if (v)
+      out.push_back(',');
+
+    out.append("{\"buffer\":0,\"byteOffset\":");
+    AppendInt(out, cView.offset);
+    out.append(",\"byteLength\":");
+    AppendInt(out, cView.size);
+
+    if (cView.stride) {
+      out.append(",\"byteStride\":");
+      AppendInt(out, cView.stride);
+    }
+
+    if (cView.target) {
+      out.append(",\"target\":");
+      AppendInt(out, cView.target);
+    }
+
+    out.push_back('}');
+  }
+
+  out.append("],");
+}
+
+void GLTFExporter::AppendAccessors(std::string &out) const {
+  out.append("\"accessors\":[");
+
+  for (size_t a = 0; a < accessors.size(); a++) {
+    const GLTFAccessor &cAccessor = accessors[a];
+
+    if (a)
+      out.push_back(',');
+
+    out.push_back('{');
+
+    if (cAccessor.view > -1) {
+      out.append("\"bufferView\":");
+      AppendInt(out, cAccessor.view);
+      out.push_back(',');
+
+      if (cAccessor.offset) {
+        out.append("\"byteOffset\":");
+        AppendInt(out, cAccessor.offset);
+        out.push_back(',');
+      }
+    }
+
+    out.append("\"componentType\":");
+    AppendInt(out, cAccessor.componentType);
+
+    if (cAccessor.normalized)
+      out.append(",\"normalized\":true");
+
+    out.append(",\"count\":");
+    AppendInt(out, cAccessor.count);
+    out.append(",\"type\":\"");
+    out.append(cAccessor.type);
+    out.push_back('"');
+
+    if (cAccessor.hasBounds)
+      for (int b = 0; b < 2; b++) {
+        const float *values = b ? cAccessor.bbMax : cAccessor.bbMin;
+        out.append(b ? ",\"max\":[" : ",\"min\":[");
+
+        for (int c = 0; c < 3; c++) {
+          if (c)
+            out.push_back(',');
+
+          AppendFloat(out, values[c]);
+        }
+
+        out.push_back(']');
+      }
+
+    if (cAccessor.numSparse) {
+      out.append(",\"sparse\":{\"count\":");
+      AppendInt(out, cAccessor.numSparse);
+      out.append(",\"indices\":{\"bufferView\":");
+      AppendInt(out, cAccessor.sparseIndices);
+      out.append(",\"componentType\":");
+      AppendInt(out, GLTF_UNSIGNED_INT);
+      out.append("},\"values\":{\"bufferView\":");
+      AppendInt(out, cAccessor.sparseValues);
+      out.append("}}");
+    }
+
+    out.push_back('}');
+  }
+
+  out.append("],");
+}
+
+int GLTFExporter::Plan(std::string &json) {
+  MXMDModel::Ptr model = file.GetModel();
+
+  if (!model)
+    return 1;
+
+  MXMDInstances::Ptr instances =
+      params.noInstances ? nullptr : file.GetInstances();
+  const bool instanced = instances && instances->GetNumInstances() > 0;
+  MXMDMaterials::Ptr materials = file.GetMaterials();
+  const int numMaterials = materials ? materials->GetNumMaterials() : 0;
+  const int numMeshGroups = model->GetNumMeshGroups();
+
+  // Skeleton nodes come first, node index is bone index
+  const int numBones = model->GetNumBones();
+  std::vector<MXMDTransformMatrix> localTransforms(numBones),
+      absoluteTransforms(numBones);
+  std::vector<std::vector<int>> children(numBones);
+  std::vector<std::string> nodes(numBones);
+  std::vector<int> rootNodes;
+  std::unordered_map<std::string, int> boneNames;
+
+  model->GetBoneTransforms(localTransforms.data(), absoluteTransforms.data());
+
+  for (int b = 0; b < numBones; b++) {
+    MXMDBone::Ptr cBone = model->GetBone(b);
+    const int parentID = cBone->GetParentID();
+    const char *boneName = cBone->GetName();
+
+    boneNames.insert(std::make_pair(boneName, b));
+
+    if (parentID > -1 && parentID < numBones && parentID != b)
+      children[parentID].push_back(b);
+    else
+      rootNodes.push_back(b);
+
+    std::string &cNode = nodes[b];
+    cNode.append("{\"name\":");
+    AppendString(cNode, boneName);
+    cNode.push_back(',');
+    AppendMatrix(cNode, localTransforms[b]);
+  }
+
+  // Unresolved or duplicate skin bones get own identity node, duplicates are
+  // parented to already used joint.
+  std::vector<int> joints;
+  const int numSkinBones = params.noSkins ? 0 : model->GetNumSkinBones();
+
+  if (numBones && numSkinBones) {
+    std::vector<bool> usedJoints(numBones);
+
+    for (int s = 0; s < numSkinBones; s++) {
+      MXMDBone::Ptr cBone = model->GetSkinBone(s);
+      auto found = cBone ? boneNames.find(cBone->GetName()) : boneNames.end();
+      const int nodeID = found != boneNames.end() ? found->second : -1;
+
+      if (nodeID > -1 && !usedJoints[nodeID]) {
+        usedJoints[nodeID] = true;
+        joints.push_back(nodeID);
+        inverseBinds.push_back(InverseTransform(absoluteTransforms[nodeID]));
+        continue;
+      }
+
+      const int placeholderID = static_cast<int>(nodes.size());
+      std::string cNode("{\"name\":");
+      AppendString(cNode, ("skin_bone_" + std::to_string(s)).c_str());
+      nodes.push_back(cNode);
+      children.push_back(std::vector<int>());
+      joints.push_back(placeholderID);
+
+      if (nodeID > -1) {
+        children[nodeID].push_back(placeholderID);
+        inverseBinds.push_back(InverseTransform(absoluteTransforms[nodeID]));
+      } else {
+        rootNodes.push_back(placeholderID);
+        inverseBinds.push_back(gltfIdentity);
+      }
+    }
+  }
+
+  const size_t numSkeletonNodes = nodes.size();
+
+  for (size_t n = 0; n < numSkeletonNodes; n++) {
+    if (children[n].size()) {
+      nodes[n].append(",\"children\":[");
+
+      for (size_t c = 0; c < children[n].size(); c++) {
+        if (c)
+          nodes[n].push_back(',');
+
+        AppendInt(nodes[n], children[n][c]);
+      }
+
+      nodes[n].push_back(']');
+    }
+
+    nodes[n].push_back('}');
+  }
+
+  // Meshes
+  std::vector<int> meshGroupMeshes(numMeshGroups, -1);
+  std::vector<bool> skinnedMeshes;
+  std::vector<std::string> meshes;
+
+  if (instanced) {
+    const int numInstances = instances->GetNumInstances();
+
+    for (int i = 0; i < numInstances; i++) {
+      const int startingGroup = instances->GetStartingGroup(i);
+      const int endGroup = startingGroup + instances->GetNumGroups(i);
+
+      for (int g = startingGroup; g < endGroup; g++) {
+        const int meshGroup = instances->GetMeshGroup(g);
+
+        if (meshGroup > -1 && meshGroup < numMeshGroups)
+          meshGroupMeshes[meshGroup] = 0;
+      }
+    }
+  } else
+    std::fill(meshGroupMeshes.begin(), meshGroupMeshes.end(), 0);
+
+  for (int m = 0; m < numMeshGroups; m++) {
+    if (meshGroupMeshes[m] < 0)
+      continue;
+
+    // Geometry group per mesh group for maps, shared geometry otherwise
+    const int group = instanced ? m : 0;
+    MXMDMeshGroup::Ptr cGroup = model->GetMeshGroup(m);
+    const int numMeshObjects = cGroup->GetNumMeshObjects();
+
+    struct Primitive {
+      GLTFVertexBuffer *buffer;
+      int indices;
+      int material;
+      std::pair<int, int> skin;
+    };
+
+    std::vector<Primitive> primitives;
+    std::vector<int> targetNames;
+
+    for (int o = 0; o < numMeshObjects; o++) {
+      MXMDMeshObject::Ptr cObject = cGroup->GetMeshObject(o);
+      const int bufferID = cObject->GetBufferID();
+      Primitive cPrimitive;
+      cPrimitive.buffer = &PlanVertexBuffer(group, bufferID);
+      cPrimitive.indices = PlanIndices(group, cObject->GetMeshFacesID());
+      cPrimitive.material = cObject->GetMaterialID();
+      cPrimitive.skin = std::make_pair(-1, -1);
+
+      bool hasPositions = false;
+
+      for (auto &a : cPrimitive.buffer->attributes)
+        hasPositions |= !strcmp(a.first, "POSITION");
+
+      if (!hasPositions || cPrimitive.indices < 0)
+        continue;
+
+      if (joints.size())
+        cPrimitive.skin =
+            PlanSkin(group, *cPrimitive.buffer, cObject->GetSkinDesc());
+
+      if (!params.noMorphs) {
+        PlanMorphs(group, bufferID, *cPrimitive.buffer);
+
+        for (int n : cPrimitive.buffer->morphNames)
+          if (std::find(targetNames.begin(), targetNames.end(), n) ==
+              targetNames.end())
+            targetNames.push_back(n);
+      }
+
+      primitives.push_back(cPrimitive);
+    }
+
+    if (primitives.empty()) {
+      meshGroupMeshes[m] = -1;
+      continue;
+    }
+
+    // Skinned mesh needs joints and weights in every primitive
+    bool skinned = false;
+
+    for (auto &p : primitives)
+      skinned |= p.skin.first > -1;
+
+    if (skinned)
+      for (auto &p : primitives)
+        if (p.skin.first < 0)
+          p.skin = RigidSkin(p.buffer->numVertices);
+
+    std::string cMesh("{\"name\":");
+    AppendString(cMesh, ("mesh_group_" + std::to_string(m)).c_str());
+    cMesh.append(",\"primitives\":[");
+
+    for (size_t p = 0; p < primitives.size(); p++) {
+      const Primitive &cPrimitive = primitives[p];
+
+      if (p)
+        cMesh.push_back(',');
+
+      cMesh.append("{\"attributes\":{");
+
+      for (size_t a = 0; a < cPrimitive.buffer->attributes.size(); a++) {
+        if (a)
+          cMesh.push_back(',');
+
+        AppendString(cMesh, cPrimitive.buffer->attributes[a].first);
+        cMesh.push_back(':');
+        AppendInt(cMesh, cPrimitive.buffer->attributes[a].second);
+      }
+
+      if (cPrimitive.skin.first > -1) {
+        cMesh.append(",\"JOINTS_0\":");
+        AppendInt(cMesh, cPrimitive.skin.first);
+        cMesh.append(",\"WEIGHTS_0\":");
+        AppendInt(cMesh, cPrimitive.skin.second);
+      }
+
+      cMesh.append("},\"indices\":");
+      AppendInt(cMesh, cPrimitive.indices);
+
+      if (cPrimitive.material > -1 && cPrimitive.material < numMaterials) {
+        cMesh.append(",\"material\":");
+        AppendInt(cMesh, cPrimitive.material);
+      }
+
+      cMesh.append(",\"mode\":");
+      AppendInt(cMesh, gltfTriangles);
+
+      // Every primitive needs the same targets, missing ones are zero
+      if (targetNames.size()) {
+        const GLTFVertexBuffer &cBuffer = *cPrimitive.buffer;
+        cMesh.append(",\"targets\":[");
+
+        for (size_t t = 0; t < targetNames.size(); t++) {
+          const auto found = std::find(cBuffer.morphNames.begin(),
+                                       cBuffer.morphNames.end(),
+                                       targetNames[t]);
+          std::pair<int, int> target(ZeroAccessor(cBuffer.numVertices), -1);
+
+          if (found != cBuffer.morphNames.end())
+            target = cBuffer.morphTargets[found - cBuffer.morphNames.begin()];
+
+          if (t)
+            cMesh.push_back(',');
+
+          cMesh.append("{\"POSITION\":");
+          AppendInt(cMesh, target.first);
+
+          if (target.second > -1) {
+            cMesh.append(",\"NORMAL\":");
+            AppendInt(cMesh, target.second);
+          }
+
+          cMesh.push_back('}');
+        }
+
+        cMesh.push_back(']');
+      }
+
+      cMesh.push_back('}');
+    }
+
+    cMesh.push_back(']');
+
+    if (targetNames.size()) {
+      cMesh.append(",\"weights\":[");
+
+      for (size_t t = 0; t < targetNames.size(); t++)
+        cMesh.append(t ? ",0" : "0");
+
+      cMesh.append("],\"extras\":{\"targetNames\":[");
+
+      for (size_t t = 0; t < targetNames.size(); t++) {
+        const char *morphName = model->GetMorphName(targetNames[t]);
+
+        if (t)
+          cMesh.push_back(',');
+
+        AppendString(cMesh,
+                     morphName
+                         ? morphName
+                         : ("morph_" + std::to_string(targetNames[t])).c_str());
+      }
+
+      cMesh.append("]}");
+    }
+
+    cMesh.push_back('}');
+    meshGroupMeshes[m] = static_cast<int>(meshes.size());
+    meshes.push_back(cMesh);
+    skinnedMeshes.push_back(skinned);
+  }
+
+  // Mesh nodes
+  const auto addMeshNode = [&](const std::string &name, int mesh,
+                               const MXMDTransformMatrix *mtx) {
+    std::string cNode("{\"name\":");
+    AppendString(cNode, name.c_str());
+    cNode.append(",\"mesh\":");
+    AppendInt(cNode, mesh);
+
+    if (mtx) {
+      cNode.push_back(',');
+      AppendMatrix(cNode, *mtx);
+    } else if (skinnedMeshes[mesh])
+      cNode.append(",\"skin\":0");
+
+    cNode.push_back('}');
+    rootNodes.push_back(static_cast<int>(nodes.size()));
+    nodes.push_back(cNode);
+  };
+
+  if (instanced) {
+    const int numInstances = instances->GetNumInstances();
+
+    for (int i = 0; i < numInstances; i++) {
+      const int startingGroup = instances->GetStartingGroup(i);
+      const int endGroup = startingGroup + instances->GetNumGroups(i);
+
+      for (int g = startingGroup; g < endGroup; g++) {
+        const int meshGroup = instances->GetMeshGroup(g);
+
+        if (meshGroup < 0 || meshGroup >= numMeshGroups ||
+            meshGroupMeshes[meshGroup] < 0)
+          continue;
+
+        addMeshNode("instance_" + std::to_string(i) + "_" +
+                        std::to_string(g),
+                    meshGroupMeshes[meshGroup], instances->GetTransform(i));
+      }
+    }
+  } else
+    for (int m = 0; m < numMeshGroups; m++)
+      if (meshGroupMeshes[m] > -1)
+        addMeshNode("mesh_group_" + std::to_string(m), meshGroupMeshes[m],
+                    nullptr);
+
+  int inverseBindsAccessor = -1;
+
+  if (joints.size()) {
+    const int view = AddView(
+        inverseBinds.size() * sizeof(MXMDTransformMatrix), 0, 0,
+        reinterpret_cast<const char *>(inverseBinds.data()));
+    inverseBindsAccessor = AddAccessor(GLTFAccessor(
+        view, GLTF_FLOAT, static_cast<int>(inverseBinds.size()), "MAT4"));
+  }
+
+  // Document
+  json.append("{\"asset\":{\"version\":\"2.0\",\"generator\":\"XenoLib\"},");
+
+  if (quantized)
+    json.append("\"extensionsUsed\":[\"KHR_mesh_quantization\"],"
+                "\"extensionsRequired\":[\"KHR_mesh_quantization\"],");
+
+  json.append("\"scene\":0,\"scenes\":[{");
+
+  if (rootNodes.size()) {
+    json.append("\"nodes\":[");
+
+    for (size_t n = 0; n < rootNodes.size(); n++) {
+      if (n)
+        json.push_back(',');
+
+      AppendInt(json, rootNodes[n]);
+    }
+
+    json.push_back(']');
+  }
+
+  json.append("}],");
+
+  const auto appendItems = [&json](const char *name,
+                                   const std::vector<std::string> &items) {
+    if (items.empty())
+      return;
+
+    AppendString(json, name);
+    json.append(":[");
+
+    for (size_t i = 0; i < items.size(); i++) {
+      if (i)
+        json.push_back(',');
+
+      json.append(items[i]);
+    }
+
+    json.append("],");
+  };
+
+  appendItems("nodes", nodes);
+  appendItems("meshes", meshes);
+
+  std::vector<std::string> materialItems(numMaterials);
+
+  for (int m = 0; m < numMaterials; m++) {
+    MXMDMaterial::Ptr cMaterial = materials->GetMaterial(m);
+    materialItems[m] = "{\"name\":";
+    AppendString(materialItems[m], cMaterial->GetName());
+    materialItems[m].push_back('}');
+  }
+
+  appendItems("materials", materialItems);
+
+  if (joints.size()) {
+    json.append("\"skins\":[{\"inverseBindMatrices\":");
+    AppendInt(json, inverseBindsAccessor);
+    json.append(",\"joints\":[");
+
+    for (size_t j = 0; j < joints.size(); j++) {
+      if (j)
+        json.push_back(',');
+
+      AppendInt(json, joints[j]);
+    }
+
+    json.append("]}],");
+  }
+
+  if (accessors.size())
+    AppendAccessors(json);
+
+  if (views.size())
+    AppendViews(json);
+
+  if (binSize) {
+    json.append("\"buffers\":[{\"byteLength\":");
+    AppendInt(json, binSize);
+    json.append("}],");
+  }
+
+  json.back() = '}';
+
+  return 0;
+}
+
+// Views are written one by one, converted data exists only for single view.
+int GLTFExporter::WriteBinary(std::ostream &str) const {
+  static const char padding[4] = {};
+  std::vector<char> scratch;
+  size_t written = 0;
+
+  for (auto &v : views) {
+    str.write(padding, v.offset - written);
+
+    if (v.source)
+      str.write(v.source, v.size);
+    else {
+      scratch.resize(v.size);
+      v.fill(scratch.data());
+      str.write(scratch.data(), v.size);
+    }
+
+    written = v.offset + v.size;
+  }
+
+  str.write(padding, ((written + 3) & ~static_cast<size_t>(3)) - written);
+
+  return str.fail() ? 2 : 0;
+}
+
+template <class _Ty>
+static int _ExportGLB(MXMD &file, const _Ty *_path, MXMDGLTFParams params) {
+  GLTFExporter exporter(file, params);
+  std::string json;
+
+  if (exporter.Plan(json)) {
+    printerror("[MXMD] Cannot export GLB, model not found.");
+    return 1;
+  }
+
+  while (json.size() & 3)
+    json.push_back(' ');
+
+  UniString<_Ty> path = _path;
+  std::ofstream ofs(esStringConvert<TCHAR>(path.c_str()),
+                    std::ios::binary | std::ios::out);
+
+  if (ofs.fail()) {
+    printerror("[MXMD] Cannot create file at \"",
+               << path.c_str()
+               << " \", make sure you can write there or path is valid.");
+    return 2;
+  }
+
+  const size_t binSize = (exporter.BinarySize() + 3) & ~static_cast<size_t>(3);
+  const int jsonSize = static_cast<int>(json.size());
+  const int header[] = {
+      glbMagic, glbVersion,
+      static_cast<int>(12 + 8 + json.size() + (binSize ? 8 + binSize : 0))};
+  const int jsonHeader[] = {jsonSize, glbChunkJSON};
+
+  ofs.write(reinterpret_cast<const char *>(header), sizeof(header));
+  ofs.write(reinterpret_cast<const char *>(jsonHeader), sizeof(jsonHeader));
+  ofs.write(json.data(), jsonSize);
+
+  if (binSize) {
+    const int binHeader[] = {static_cast<int>(binSize), glbChunkBIN};
+    ofs.write(reinterpret_cast<const char *>(binHeader), sizeof(binHeader));
+
+    if (exporter.WriteBinary(ofs)) {
+      printerror("[MXMD] Cannot write GLB binary chunk.");
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+int ExportGLB(MXMD &file, const char *path, MXMDGLTFParams params) {
+  return _ExportGLB(file, path, params);
+}
+
+int ExportGLB(MXMD &file, const wchar_t *path, MXMDGLTFParams params) {
+  return _ExportGLB(file, path, params);
+}
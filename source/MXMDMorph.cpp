@@ -0,0 +1,247 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MXMDMorph.h"
+#include "XenoLibScheduler.h"
+#include "datas/masterprinter.hpp"
+#include <algorithm>
+#include <emmintrin.h>
+
+static const int morphVertexChunk = 0x1000;
+
+int MXMDMorphSet::Decode(const MXMDMorphTargets &morphs) {
+  MXMDVertexBuffer::DescriptorCollection baseColl = morphs.GetBaseMorph();
+  int numVertices = 0;
+
+  targets.clear();
+  basePositions.clear();
+  baseNormals.clear();
+
+  for (auto &d : baseColl)
+    if (d->Type() == MXMD_POSITION)
+      numVertices = d->Size();
+
+  if (!numVertices) {
+    printerror("[MXMD] Morph targets without base morph.");
+    return 1;
+  }
+
+  basePositions.resize(numVertices);
+  baseNormals.resize(numVertices);
+
+  for (auto &d : baseColl) {
+    if (d->Type() == MXMD_POSITION) {
+      for (int v = 0; v < numVertices; v++)
+        d->Evaluate(v, &basePositions[v]);
+    } else if (d->Type() == MXMD_NORMALMORPH) {
+      Vector4 cNormal;
+
+      for (int v = 0; v < numVertices; v++) {
+        d->Evaluate(v, &cNormal);
+        baseNormals[v] = Vector(cNormal.X, cNormal.Y, cNormal.Z);
+      }
+    }
+  }
+
+  const int numTargets = morphs.GetNumMorphs();
+  targets.resize(numTargets);
+
+  for (int t = 0; t < numTargets; t++) {
+    MXMDVertexBuffer::DescriptorCollection coll = morphs.GetDeltaMorph(t);
+    Target &cTarget = targets[t];
+    MXMDVertexDescriptor *ids = nullptr, *positions = nullptr,
+                         *normals = nullptr;
+
+    cTarget.nameID = morphs.GetMorphNameID(t);
+
+    for (auto &d : coll)
+      switch (d->Type()) {
+      case MXMD_MORPHVERTEXID:
+        ids = d.get();
+        break;
+      case MXMD_POSITION:
+        positions = d.get();
+        break;
+      case MXMD_NORMALMORPH:
+        normals = d.get();
+        break;
+      default:
+        break;
+      }
+
+    if (!positions)
+      continue;
+
+    const int numItems = positions->Size();
+    std::vector<int> order(numItems);
+    std::vector<int> vertexIDs(numItems);
+
+    for (int i = 0; i < numItems; i++) {
+      order[i] = i;
+
+      if (ids)
+        ids->Evaluate(i, &vertexIDs[i]);
+      else
+        vertexIDs[i] = i;
+    }
+
+    if (!std::is_sorted(vertexIDs.begin(), vertexIDs.end()))
+      std::sort(order.begin(), order.end(), [&vertexIDs](int a, int b) {
+        return vertexIDs[a] < vertexIDs[b];
+      });
+
+    cTarget.vertexIDs.resize(numItems);
+
+    for (int c = 0; c < 3; c++) {
+      cTarget.positions[c].resize(numItems);
+      cTarget.normals[c].resize(numItems);
+    }
+
+    for (int i = 0; i < numItems; i++) {
+      const int srcItem = order[i];
+      Vector cPosition;
+      Vector4 cNormal;
+
+      positions->Evaluate(srcItem, &cPosition);
+
+      if (normals)
+        normals->Evaluate(srcItem, &cNormal);
+
+      cTarget.vertexIDs[i] = vertexIDs[srcItem];
+
+      for (int c = 0; c < 3; c++) {
+        cTarget.positions[c][i] = cPosition[c];
+        cTarget.normals[c][i] = normals ? cNormal[c] : 0.0f;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Scales 4 SoA deltas at once, then scatters them into AoS output.
+static void ScatterAddDeltas(const float *const *deltas, const int *vertexIDs,
+                             int numItems, float weight, Vector *output) {
+  const __m128 vWeight = _mm_set1_ps(weight);
+  alignas(16) float scaled[3][4];
+  int i = 0;
+
+  for (; i + 4 <= numItems; i += 4) {
+    for (int c = 0; c < 3; c++)
+      _mm_store_ps(scaled[c],
+                   _mm_mul_ps(_mm_loadu_ps(deltas[c] + i), vWeight));
+
+    for (int l = 0; l < 4; l++) {
+      Vector &cItem = output[vertexIDs[i + l]];
+      cItem.X += scaled[0][l];
+      cItem.Y += scaled[1][l];
+      cItem.Z += scaled[2][l];
+    }
+  }
+
+  for (; i < numItems; i++) {
+    Vector &cItem = output[vertexIDs[i]];
+    cItem.X += deltas[0][i] * weight;
+    cItem.Y += deltas[1][i] * weight;
+    cItem.Z += deltas[2][i] * weight;
+  }
+}
+
+struct MorphApplyQueue {
+  int queue;
+  int queueEnd;
+  int numVertices;
+  const MXMDMorphSet *morphs;
+  const float *weights;
+  Vector *positions;
+  Vector *normals;
+
+  typedef void return_type;
+
+  MorphApplyQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    const int rangeBegin = queue * morphVertexChunk;
+    const int rangeEnd = std::min(rangeBegin + morphVertexChunk, numVertices);
+    const int numTargets = morphs->NumTargets();
+
+    for (int t = 0; t < numTargets; t++) {
+      if (weights[t] == 0.0f)
+        continue;
+
+      const MXMDMorphSet::Target &cTarget = morphs->GetTarget(t);
+      const int *idsBegin = cTarget.vertexIDs.data();
+      const int *idsEnd = idsBegin + cTarget.NumItems();
+      const int first = static_cast<int>(
+          std::lower_bound(idsBegin, idsEnd, rangeBegin) - idsBegin);
+      const int last = static_cast<int>(
+          std::lower_bound(idsBegin + first, idsEnd, rangeEnd) - idsBegin);
+
+      if (first == last)
+        continue;
+
+      const float *cPositions[] = {cTarget.positions[0].data() + first,
+                                   cTarget.positions[1].data() + first,
+                                   cTarget.positions[2].data() + first};
+
+      ScatterAddDeltas(cPositions, idsBegin + first, last - first, weights[t],
+                       positions);
+
+      if (!normals)
+        continue;
+
+      const float *cNormals[] = {cTarget.normals[0].data() + first,
+                                 cTarget.normals[1].data() + first,
+                                 cTarget.normals[2].data() + first};
+
+      ScatterAddDeltas(cNormals, idsBegin + first, last - first, weights[t],
+                       normals);
+    }
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+void MXMDMorphSet::Accumulate(const float *weights, Vector *positions,
+                              Vector *normals) const {
+  const int numVertices = NumVertices();
+
+  if (!numVertices)
+    return;
+
+  MorphApplyQueue applyQue;
+  applyQue.queueEnd = (numVertices + morphVertexChunk - 1) / morphVertexChunk;
+  applyQue.numVertices = numVertices;
+  applyQue.morphs = this;
+  applyQue.weights = weights;
+  applyQue.positions = positions;
+  applyQue.normals = normals;
+
+  RunScheduledQueue(applyQue);
+}
+
+void MXMDMorphSet::Apply(const float *weights, Vector *positions,
+                         Vector *normals) const {
+  std::copy(basePositions.begin(), basePositions.end(), positions);
+
+  if (normals)
+    std::copy(baseNormals.begin(), baseNormals.end(), normals);
+
+  Accumulate(weights, positions, normals);
+}
@@ -0,0 +1,675 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MXMDOptimize.h"
+#include "XenoLibScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+static const int defaultCacheSize = 16;
+static const float defaultOverdrawThreshold = 1.05f;
+static const int defaultMeshletVertices = 64;
+static const int defaultMeshletTriangles = 126;
+static const int meshletTriangleLimit = 255;
+
+// Vertex cache model used for triangle ordering, see Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation".
+static const int forsythCacheSize = 32;
+static const int forsythMaxValence = 32;
+
+struct ForsythScores {
+  float cache[forsythCacheSize];
+  float valence[forsythMaxValence + 1];
+
+  ForsythScores() {
+    for (int c = 0; c < forsythCacheSize; c++)
+      cache[c] = c < 3 ? 0.75f
+                       : std::pow(1.0f - static_cast<float>(c - 3) /
+                                             (forsythCacheSize - 3),
+                                  1.5f);
+
+    valence[0] = 0.0f;
+
+    for (int v = 1; v <= forsythMaxValence; v++)
+      valence[v] = 2.0f / std::sqrt(static_cast<float>(v));
+  }
+
+  float Score(int cachePosition, int numTriangles) const {
+    if (!numTriangles)
+      return 0.0f;
+
+    const float cacheScore = cachePosition < 0 ? 0.0f : cache[cachePosition];
+
+    return cacheScore + valence[std::min(numTriangles, forsythMaxValence)];
+  }
+};
+
+static const ForsythScores forsythScores;
+
+// FIFO cache misses of triangle list.
+static int CountCacheMisses(const int *indices, int numIndices,
+                            int numVertices, int cacheSize) {
+  std::vector<unsigned> timestamps(numVertices);
+  unsigned timestamp = cacheSize + 1;
+  int misses = 0;
+
+  for (int i = 0; i < numIndices; i++) {
+    const int v = indices[i];
+
+    if (timestamp - timestamps[v] > static_cast<unsigned>(cacheSize)) {
+      timestamps[v] = timestamp++;
+      misses++;
+    }
+  }
+
+  return misses;
+}
+
+static void OptimizeVertexCache(std::vector<int> &indices, int numVertices) {
+  const int numTriangles = static_cast<int>(indices.size()) / 3;
+  std::vector<int> adjacencyOffsets(numVertices + 1);
+  std::vector<int> numAdjacent(numVertices);
+
+  for (int i : indices)
+    numAdjacent[i]++;
+
+  for (int v = 0; v < numVertices; v++)
+    adjacencyOffsets[v + 1] = adjacencyOffsets[v] + numAdjacent[v];
+
+  std::vector<int> adjacency(indices.size());
+  std::fill(numAdjacent.begin(), numAdjacent.end(), 0);
+
+  for (int t = 0; t < numTriangles; t++)
+    for (int c = 0; c < 3; c++) {
+      const int v = indices[t * 3 + c];
+      adjacency[adjacencyOffsets[v] + numAdjacent[v]++] = t;
+    }
+
+  std::vector<int> cachePositions(numVertices, -1);
+  std::vector<float> vertexScores(numVertices);
+  std::vector<float> triangleScores(numTriangles);
+  std::vector<bool> emitted(numTriangles);
+
+  for (int v = 0; v < numVertices; v++)
+    vertexScores[v] = forsythScores.Score(-1, numAdjacent[v]);
+
+  for (int t = 0; t < numTriangles; t++)
+    triangleScores[t] = vertexScores[indices[t * 3]] +
+                        vertexScores[indices[t * 3 + 1]] +
+                        vertexScores[indices[t * 3 + 2]];
+
+  std::vector<int> output;
+  output.reserve(indices.size());
+  int cache[forsythCacheSize + 3];
+  int cacheCount = 0;
+  int bestTriangle = -1;
+  float bestScore = -1.0f;
+  int scanCursor = 0;
+
+  for (int t = 0; t < numTriangles; t++)
+    if (triangleScores[t] > bestScore) {
+      bestScore = triangleScores[t];
+      bestTriangle = t;
+    }
+
+  while (bestTriangle > -1) {
+    const int *triangle = &indices[bestTriangle * 3];
+    emitted[bestTriangle] = true;
+    output.insert(output.end(), triangle, triangle + 3);
+
+    int newCache[forsythCacheSize + 3];
+    int newCount = 0;
+
+    for (int c = 0; c < 3; c++) {
+      const int v = triangle[c];
+      newCache[newCount++] = v;
+
+      // Remove emitted triangle from adjacency
+      int *adjacent = &adjacency[adjacencyOffsets[v]];
+      int &numVertexAdjacent = numAdjacent[v];
+
+      for (int a = 0; a < numVertexAdjacent; a++)
+        if (adjacent[a] == bestTriangle) {
+          adjacent[a] = adjacent[--numVertexAdjacent];
+          break;
+        }
+    }
+
+    for (int c = 0; c < cacheCount; c++) {
+      const int v = cache[c];
+
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+        newCache[newCount++] = v;
+    }
+
+    // Vertices pushed out of cache lose their cache score
+    for (int c = forsythCacheSize; c < newCount; c++)
+      cachePositions[newCache[c]] = -1;
+
+    cacheCount = std::min(newCount, forsythCacheSize);
+    memcpy(cache, newCache, cacheCount * sizeof(int));
+
+    for (int c = 0; c < cacheCount; c++)
+      cachePositions[cache[c]] = c;
+
+    bestTriangle = -1;
+    bestScore = -1.0f;
+
+    for (int c = 0; c < newCount; c++) {
+      const int v = newCache[c];
+      const float newScore =
+          forsythScores.Score(cachePositions[v], numAdjacent[v]);
+      const float scoreDelta = newScore - vertexScores[v];
+      vertexScores[v] = newScore;
+
+      const int *adjacent = &adjacency[adjacencyOffsets[v]];
+
+      for (int a = 0; a < numAdjacent[v]; a++) {
+        const int t = adjacent[a];
+        triangleScores[t] += scoreDelta;
+
+        if (c < cacheCount && triangleScores[t] > bestScore) {
+          bestScore = triangleScores[t];
+          bestTriangle = t;
+        }
+      }
+    }
+
+    // No cached candidates, continue with next unemitted triangle
+    if (bestTriangle < 0) {
+      while (scanCursor < numTriangles && emitted[scanCursor])
+        scanCursor++;
+
+      if (scanCursor < numTriangles)
+        bestTriangle = scanCursor;
+    }
+  }
+
+  indices.swap(output);
+}
+
+// Splits cache optimized triangles into clusters and sorts them outwards
+// facing first, so occluding surfaces tend to be drawn early.
+static void OptimizeOverdraw(std::vector<int> &indices,
+                             const std::vector<Vector> &positions,
+                             int numVertices, int cacheSize, float threshold) {
+  const int numTriangles = static_cast<int>(indices.size()) / 3;
+
+  if (numTriangles < 2)
+    return;
+
+  // Hard boundaries are triangles missing cache with every vertex
+  std::vector<int> clusters;
+  std::vector<unsigned> timestamps(numVertices);
+  unsigned timestamp = cacheSize + 1;
+
+  for (int t = 0; t < numTriangles; t++) {
+    int misses = 0;
+
+    for (int c = 0; c < 3; c++) {
+      const int v = indices[t * 3 + c];
+
+      if (timestamp - timestamps[v] > static_cast<unsigned>(cacheSize)) {
+        timestamps[v] = timestamp++;
+        misses++;
+      }
+    }
+
+    if (misses == 3 || !t)
+      clusters.push_back(t);
+  }
+
+  clusters.push_back(numTriangles);
+
+  const int numClusters = static_cast<int>(clusters.size()) - 1;
+
+  if (numClusters < 2)
+    return;
+
+  Vector meshCenter;
+  float meshArea = 0.0f;
+  std::vector<Vector> centers(numClusters), normals(numClusters);
+
+  for (int cl = 0; cl < numClusters; cl++) {
+    Vector clusterCenter, clusterNormal;
+    float clusterArea = 0.0f;
+
+    for (int t = clusters[cl]; t < clusters[cl + 1]; t++) {
+      const Vector &p0 = positions[indices[t * 3]];
+      const Vector &p1 = positions[indices[t * 3 + 1]];
+      const Vector &p2 = positions[indices[t * 3 + 2]];
+      const Vector e0 = p1 - p0;
+      const Vector e1 = p2 - p0;
+      const Vector normal(e0.Y * e1.Z - e0.Z * e1.Y, e0.Z * e1.X - e0.X * e1.Z,
+                          e0.X * e1.Y - e0.Y * e1.X);
+      const float area = std::sqrt(normal.X * normal.X + normal.Y * normal.Y +
+                                   normal.Z * normal.Z);
+
+      clusterCenter = clusterCenter + (p0 + p1 + p2) * (area / 3.0f);
+      clusterNormal = clusterNormal + normal;
+      clusterArea += area;
+    }
+
+    meshCenter = meshCenter + clusterCenter;
+    meshArea += clusterArea;
+    centers[cl] = clusterArea > 0.0f ? clusterCenter * (1.0f / clusterArea)
+                                     : positions[indices[clusters[cl] * 3]];
+    normals[cl] = clusterNormal;
+  }
+
+  if (meshArea > 0.0f)
+    meshCenter = meshCenter * (1.0f / meshArea);
+
+  std::vector<float> sortKeys(numClusters);
+  std::vector<int> order(numClusters);
+
+  for (int cl = 0; cl < numClusters; cl++) {
+    const Vector &n = normals[cl];
+    const float length = std::sqrt(n.X * n.X + n.Y * n.Y + n.Z * n.Z);
+    const Vector offset = centers[cl] - meshCenter;
+
+    sortKeys[cl] = length > 0.0f ? (offset.X * n.X + offset.Y * n.Y +
+                                    offset.Z * n.Z) /
+                                       length
+                                 : 0.0f;
+    order[cl] = cl;
+  }
+
+  std::stable_sort(order.begin(), order.end(), [&sortKeys](int a, int b) {
+    return sortKeys[a] > sortKeys[b];
+  });
+
+  std::vector<int> output;
+  output.reserve(indices.size());
+
+  for (int cl : order)
+    output.insert(output.end(), indices.begin() + clusters[cl] * 3,
+                  indices.begin() + clusters[cl + 1] * 3);
+
+  const int oldMisses = CountCacheMisses(
+      indices.data(), static_cast<int>(indices.size()), numVertices, cacheSize);
+  const int newMisses = CountCacheMisses(
+      output.data(), static_cast<int>(output.size()), numVertices, cacheSize);
+
+  if (newMisses <= oldMisses * threshold)
+    indices.swap(output);
+}
+
+static void BuildMeshlets(MXMDOptimizedMesh &mesh, int maxVertices,
+                          int maxTriangles) {
+  const int numTriangles = mesh.NumTriangles();
+  std::vector<int> localIDs(mesh.NumVertices(), -1);
+  MXMDOptimizedMesh::Meshlet cMeshlet = {};
+
+  const auto flush = [&]() {
+    if (!cMeshlet.numTriangles)
+      return;
+
+    for (int v = 0; v < cMeshlet.numVertices; v++)
+      localIDs[mesh.meshletVertices[cMeshlet.firstVertex + v]] = -1;
+
+    mesh.meshlets.push_back(cMeshlet);
+    cMeshlet.firstVertex = static_cast<int>(mesh.meshletVertices.size());
+    cMeshlet.firstTriangle = static_cast<int>(mesh.meshletTriangles.size()) / 3;
+    cMeshlet.numVertices = 0;
+    cMeshlet.numTriangles = 0;
+  };
+
+  for (int t = 0; t < numTriangles; t++) {
+    const int *triangle = &mesh.indices[t * 3];
+    int numNew = 0;
+
+    for (int c = 0; c < 3; c++)
+      numNew += localIDs[triangle[c]] < 0 &&
+                (c < 1 || triangle[c] != triangle[0]) &&
+                (c < 2 || triangle[c] != triangle[1]);
+
+    if (cMeshlet.numVertices + numNew > maxVertices ||
+        cMeshlet.numTriangles + 1 > maxTriangles)
+      flush();
+
+    for (int c = 0; c < 3; c++) {
+      int &localID = localIDs[triangle[c]];
+
+      if (localID < 0) {
+        localID = cMeshlet.numVertices++;
+        mesh.meshletVertices.push_back(triangle[c]);
+      }
+
+      mesh.meshletTriangles.push_back(static_cast<uchar>(localID));
+    }
+
+    cMeshlet.numTriangles++;
+  }
+
+  flush();
+}
+
+struct MXMDWeldHash {
+  const std::vector<char> *keys;
+  size_t keySize;
+
+  size_t operator()(int v) const {
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(keys->data() + v * keySize);
+    // FNV-1a
+    size_t hash = 2166136261U;
+
+    for (size_t b = 0; b < keySize; b++)
+      hash = (hash ^ data[b]) * 16777619U;
+
+    return hash;
+  }
+};
+
+struct MXMDWeldEqual {
+  const std::vector<char> *keys;
+  size_t keySize;
+
+  bool operator()(int a, int b) const {
+    return !memcmp(keys->data() + a * keySize, keys->data() + b * keySize,
+                   keySize);
+  }
+};
+
+struct OptimizeJob {
+  std::shared_ptr<MXMDGeomBuffers> geometry;
+  int vertexBuffer;
+  int faceBuffer;
+};
+
+static void OptimizeMesh(const OptimizeJob &job,
+                         const MXMDMeshOptimizeParams &params,
+                         MXMDOptimizedMesh &mesh, int &numSourceVertices) {
+  numSourceVertices = 0;
+  const MXMDGeomBuffers &geometry = *job.geometry;
+
+  if (job.vertexBuffer < 0 ||
+      job.vertexBuffer >= geometry.GetNumVertexBuffers() ||
+      job.faceBuffer < 0 || job.faceBuffer >= geometry.GetNumFaceBuffers())
+    return;
+
+  MXMDVertexBuffer::Ptr vBuffer = geometry.GetVertexBuffer(job.vertexBuffer);
+  MXMDFaceBuffer::Ptr faces = geometry.GetFaceBuffer(job.faceBuffer);
+
+  if (!vBuffer || !faces)
+    return;
+
+  const int numBufferVertices = vBuffer->NumVertices();
+  const int numIndices = faces->GetNumIndices() / 3 * 3;
+  const ushort *sourceIndices =
+      reinterpret_cast<const ushort *>(faces->GetBuffer());
+
+  // Compact referenced vertices, drop out of range triangles
+  std::vector<int> compactIDs(numBufferVertices, -1);
+  std::vector<int> sourceVertices;
+  std::vector<int> indices;
+  indices.reserve(numIndices);
+
+  for (int i = 0; i < numIndices; i += 3) {
+    if (sourceIndices[i] >= numBufferVertices ||
+        sourceIndices[i + 1] >= numBufferVertices ||
+        sourceIndices[i + 2] >= numBufferVertices)
+      continue;
+
+    for (int c = 0; c < 3; c++) {
+      int &compactID = compactIDs[sourceIndices[i + c]];
+
+      if (compactID < 0) {
+        compactID = static_cast<int>(sourceVertices.size());
+        sourceVertices.push_back(sourceIndices[i + c]);
+      }
+
+      indices.push_back(compactID);
+    }
+  }
+
+  int numVertices = static_cast<int>(sourceVertices.size());
+  numSourceVertices = numVertices;
+
+  if (!numVertices)
+    return;
+
+  const int cacheSize = params.cacheSize > 0 ? params.cacheSize
+                                             : defaultCacheSize;
+  const int numTriangles = static_cast<int>(indices.size()) / 3;
+
+  mesh.acmrBefore =
+      static_cast<float>(CountCacheMisses(indices.data(),
+                                          static_cast<int>(indices.size()),
+                                          numVertices, cacheSize)) /
+      numTriangles;
+
+  MXMDVertexBuffer::DescriptorCollection descs = vBuffer->GetDescriptors();
+  const int numAttributes = static_cast<int>(descs.size());
+  std::vector<Vector> positions(numVertices);
+
+  for (auto &d : descs)
+    if (d->Type() == MXMD_POSITION)
+      for (int v = 0; v < numVertices; v++)
+        d->Evaluate(sourceVertices[v], &positions[v]);
+
+  if (!params.noWeld && numAttributes) {
+    // Vertices are compared by whole interleaved records, so attributes
+    // without descriptor are accounted for as well.
+    const char *raw = vBuffer->GetRawBuffer();
+    const int stride = vBuffer->GetStride();
+    const size_t keySize =
+        raw && stride > 0 ? stride : sizeof(Vector4) * numAttributes;
+    std::vector<char> keys(numVertices * keySize);
+
+    for (int v = 0; v < numVertices; v++) {
+      char *key = &keys[v * keySize];
+
+      if (raw && stride > 0) {
+        memcpy(key, raw + keySize * sourceVertices[v], keySize);
+        continue;
+      }
+
+      for (int a = 0; a < numAttributes; a++) {
+        Vector4 value;
+        descs[a]->Evaluate(sourceVertices[v], &value);
+        memcpy(key + sizeof(Vector4) * a, &value, sizeof(Vector4));
+      }
+    }
+
+    const MXMDWeldHash hasher = {&keys, keySize};
+    const MXMDWeldEqual equal = {&keys, keySize};
+    std::unordered_map<int, int, MXMDWeldHash, MXMDWeldEqual> unique(
+        numVertices, hasher, equal);
+    std::vector<int> weldIDs(numVertices);
+    std::vector<int> weldedVertices;
+
+    for (int v = 0; v < numVertices; v++) {
+      auto inserted = unique.insert(
+          std::make_pair(v, static_cast<int>(weldedVertices.size())));
+
+      if (inserted.second)
+        weldedVertices.push_back(v);
+
+      weldIDs[v] = inserted.first->second;
+    }
+
+    for (int &i : indices)
+      i = weldIDs[i];
+
+    std::vector<int> weldedSources(weldedVertices.size());
+    std::vector<Vector> weldedPositions(weldedVertices.size());
+
+    for (size_t v = 0; v < weldedVertices.size(); v++) {
+      weldedSources[v] = sourceVertices[weldedVertices[v]];
+      weldedPositions[v] = positions[weldedVertices[v]];
+    }
+
+    sourceVertices.swap(weldedSources);
+    positions.swap(weldedPositions);
+    numVertices = static_cast<int>(sourceVertices.size());
+  }
+
+  if (!params.noCacheOptimize) {
+    OptimizeVertexCache(indices, numVertices);
+
+    if (!params.noOverdraw)
+      OptimizeOverdraw(indices, positions, numVertices, cacheSize,
+                       params.overdrawThreshold > 0.0f
+                           ? params.overdrawThreshold
+                           : defaultOverdrawThreshold);
+  }
+
+  if (!params.noFetchReorder) {
+    std::vector<int> fetchIDs(numVertices, -1);
+    std::vector<int> fetchSources;
+    fetchSources.reserve(numVertices);
+
+    for (int &i : indices) {
+      int &fetchID = fetchIDs[i];
+
+      if (fetchID < 0) {
+        fetchID = static_cast<int>(fetchSources.size());
+        fetchSources.push_back(sourceVertices[i]);
+      }
+
+      i = fetchID;
+    }
+
+    sourceVertices.swap(fetchSources);
+    numVertices = static_cast<int>(sourceVertices.size());
+  }
+
+  mesh.vertexRemap.swap(sourceVertices);
+  mesh.indices.swap(indices);
+  mesh.acmrAfter =
+      static_cast<float>(CountCacheMisses(mesh.indices.data(),
+                                          static_cast<int>(mesh.indices.size()),
+                                          numVertices, cacheSize)) /
+      numTriangles;
+
+  if (params.buildMeshlets)
+    BuildMeshlets(mesh,
+                  params.maxMeshletVertices > 2 ? params.maxMeshletVertices
+                                                : defaultMeshletVertices,
+                  params.maxMeshletTriangles > 0
+                      ? std::min(params.maxMeshletTriangles,
+                                 meshletTriangleLimit)
+                      : defaultMeshletTriangles);
+}
+
+struct OptimizeQueue {
+  int queue;
+  int queueEnd;
+  const OptimizeJob *jobs;
+  const MXMDMeshOptimizeParams *params;
+  MXMDOptimizedMesh *meshes;
+  int *numSourceVertices;
+
+  typedef void return_type;
+
+  OptimizeQueue() : queue(0) {}
+
+  return_type RetreiveItem() {
+    OptimizeMesh(jobs[queue], *params, meshes[queue],
+                 numSourceVertices[queue]);
+  }
+
+  operator bool() { return queue < queueEnd; }
+  void operator++(int) { queue++; }
+  int NumQueues() const { return queueEnd; }
+};
+
+int MXMDMeshOptimizer::Process(MXMD &file, MXMDMeshOptimizeParams params) {
+  meshes.clear();
+  report = MXMDMeshOptimizeReport();
+
+  MXMDModel::Ptr model = file.GetModel();
+
+  if (!model)
+    return 1;
+
+  // Maps store geometry per mesh group, other files share first one.
+  MXMDInstances::Ptr instances = file.GetInstances();
+  const bool instanced = instances && instances->GetNumInstances() > 0;
+  const int numMeshGroups = model->GetNumMeshGroups();
+  std::vector<OptimizeJob> jobs;
+  std::shared_ptr<MXMDGeomBuffers> sharedGeometry;
+
+  for (int m = 0; m < numMeshGroups; m++) {
+    std::shared_ptr<MXMDGeomBuffers> geometry;
+
+    if (instanced)
+      geometry = std::shared_ptr<MXMDGeomBuffers>(file.GetGeometry(m));
+    else {
+      if (!sharedGeometry)
+        sharedGeometry = std::shared_ptr<MXMDGeomBuffers>(file.GetGeometry());
+
+      geometry = sharedGeometry;
+    }
+
+    if (!geometry)
+      continue;
+
+    MXMDMeshGroup::Ptr cGroup = model->GetMeshGroup(m);
+    const int numMeshObjects = cGroup->GetNumMeshObjects();
+
+    for (int o = 0; o < numMeshObjects; o++) {
+      MXMDMeshObject::Ptr cObject = cGroup->GetMeshObject(o);
+      OptimizeJob cJob;
+      cJob.geometry = geometry;
+      cJob.vertexBuffer = cObject->GetBufferID();
+      cJob.faceBuffer = cObject->GetMeshFacesID();
+      jobs.push_back(cJob);
+
+      MXMDOptimizedMesh cMesh;
+      cMesh.meshGroup = m;
+      cMesh.meshObject = o;
+      meshes.push_back(cMesh);
+    }
+  }
+
+  std::vector<int> numSourceVertices(jobs.size());
+  OptimizeQueue optimizeQue;
+  optimizeQue.jobs = jobs.data();
+  optimizeQue.params = &params;
+  optimizeQue.meshes = meshes.data();
+  optimizeQue.numSourceVertices = numSourceVertices.data();
+  optimizeQue.queueEnd = static_cast<int>(jobs.size());
+
+  RunScheduledQueue(optimizeQue);
+
+  double missesBefore = 0.0, missesAfter = 0.0;
+
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const MXMDOptimizedMesh &cMesh = meshes[m];
+    const int numTriangles = cMesh.NumTriangles();
+
+    report.numMeshes++;
+    report.numTriangles += numTriangles;
+    report.numVerticesBefore += numSourceVertices[m];
+    report.numVerticesAfter += cMesh.NumVertices();
+    report.numMeshlets += static_cast<int>(cMesh.meshlets.size());
+    missesBefore += static_cast<double>(cMesh.acmrBefore) * numTriangles;
+    missesAfter += static_cast<double>(cMesh.acmrAfter) * numTriangles;
+  }
+
+  if (report.numTriangles) {
+    report.acmrBefore = static_cast<float>(missesBefore / report.numTriangles);
+    report.acmrAfter = static_cast<float>(missesAfter / report.numTriangles);
+  }
+
+  return 0;
+}
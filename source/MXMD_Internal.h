@@ -18,6 +18,7 @@
 #pragma once
 #include "datas/endian.hpp"
 #include "datas/vectors.hpp"
+#include <emmintrin.h>
 
 #include "MXMD.h"
 
@@ -29,6 +30,41 @@ template <class E, class C> void _ArraySwap(C &input) {
     FByteswapper(*(inputPtr + t));
 }
 
+static ES_INLINE __m128i _BulkSwap16(__m128i input) {
+  return _mm_or_si128(_mm_slli_epi16(input, 8), _mm_srli_epi16(input, 8));
+}
+
+// Swaps count contiguous 16 bit items, buffer can be unaligned.
+static ES_INLINE void _BulkSwap16(void *buffer, size_t count) {
+  ushort *items = static_cast<ushort *>(buffer);
+  const size_t numBlocks = count / 8;
+
+  for (size_t b = 0; b < numBlocks; b++, items += 8) {
+    __m128i *block = reinterpret_cast<__m128i *>(items);
+    _mm_storeu_si128(block, _BulkSwap16(_mm_loadu_si128(block)));
+  }
+
+  for (size_t t = numBlocks * 8; t < count; t++, items++)
+    FByteswapper(*items);
+}
+
+// Swaps count contiguous 32 bit items, buffer can be unaligned.
+static ES_INLINE void _BulkSwap32(void *buffer, size_t count) {
+  uint *items = static_cast<uint *>(buffer);
+  const size_t numBlocks = count / 4;
+
+  for (size_t b = 0; b < numBlocks; b++, items += 4) {
+    __m128i *block = reinterpret_cast<__m128i *>(items);
+    __m128i swapped = _BulkSwap16(_mm_loadu_si128(block));
+    swapped = _mm_shufflelo_epi16(swapped, _MM_SHUFFLE(2, 3, 0, 1));
+    swapped = _mm_shufflehi_epi16(swapped, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128(block, swapped);
+  }
+
+  for (size_t t = numBlocks * 4; t < count; t++, items++)
+    FByteswapper(*items);
+}
+
 enum MXMDVersions {
   MXMDVer1 = 10040,
   MXMDVer2 = 10111,
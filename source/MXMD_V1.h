@@ -157,14 +157,8 @@ struct MXMDVertexBuffer_V1 {
 struct MXMDFaceBuffer_V1 {
   int offset, count, null;
 
-  ES_FORCEINLINE void SwapEndian(char *masterBuffer) {
-    _ArraySwap<int>(*this);
-
-    ushort *buff = BufferRaw(masterBuffer);
-
-    for (int d = 0; d < count; d++)
-      FByteswapper(buff[d]);
-  }
+  // Indices are swapped separately, see MXMDGeometryHeader_V1_Wrap.
+  ES_FORCEINLINE void SwapEndian() { _ArraySwap<int>(*this); }
   ES_FORCEINLINE USVector *Buffer(char *masterBuffer) {
     return reinterpret_cast<USVector *>(masterBuffer + offset);
   }
@@ -196,7 +190,7 @@ struct MXMDGeometryHeader_V1 {
     MXMDFaceBuffer_V1 *fBuffers = GetFaceBuffers();
 
     for (int v = 0; v < faceBuffersCount; v++)
-      fBuffers[v].SwapEndian(GetMe());
+      fBuffers[v].SwapEndian();
   }
 
   ES_FORCEINLINE MXMDVertexBuffer_V1 *GetVertexBuffers() {
@@ -0,0 +1,352 @@
+/*      Xenoblade Engine Format Library
+        Copyright(C) 2017-2019 Lukas Cone
+
+        This program is free software : you can redistribute it and / or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "XenoLibScheduler.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#endif
+
+struct SchedulerTask {
+  std::function<void()> func;
+  SchedulerTaskGroup *group;
+};
+
+// Owner pushes and pops at back, thieves take oldest tasks from front.
+// When group is set, only tasks within that group are taken.
+class SchedulerTaskQueue {
+  std::mutex mutex;
+  std::deque<SchedulerTask> tasks;
+
+public:
+  void Push(SchedulerTask &&task) {
+    std::lock_guard<std::mutex> guard(mutex);
+    tasks.push_back(std::move(task));
+  }
+
+  bool Pop(SchedulerTask &task, const SchedulerTaskGroup *group) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    for (auto it = tasks.rbegin(); it != tasks.rend(); it++)
+      if (!group || it->group->IsWithin(group)) {
+        task = std::move(*it);
+        tasks.erase(std::next(it).base());
+        return true;
+      }
+
+    return false;
+  }
+
+  bool Steal(SchedulerTask &task, const SchedulerTaskGroup *group) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    for (auto it = tasks.begin(); it != tasks.end(); it++)
+      if (!group || it->group->IsWithin(group)) {
+        task = std::move(*it);
+        tasks.erase(it);
+        return true;
+      }
+
+    return false;
+  }
+};
+
+// Index of task queue owned by current thread, -1 outside of workers.
+static thread_local int workerIndex = -1;
+// Group of task executed by current thread.
+static thread_local SchedulerTaskGroup *currentGroup = nullptr;
+
+static void SetWorkerAffinity(std::thread &thread, uint64 affinityMask,
+                              int worker) {
+  int numCPUs = 0;
+
+  for (int c = 0; c < 64; c++)
+    numCPUs += (affinityMask >> c) & 1;
+
+  if (!numCPUs)
+    return;
+
+  int cpu = 0;
+
+  for (int n = worker % numCPUs; cpu < 64; cpu++)
+    if ((affinityMask >> cpu) & 1 && !n--)
+      break;
+
+#ifdef _WIN32
+  SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(cpu, &cpuSet);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet);
+#else
+  (void)thread;
+  (void)cpu;
+#endif
+}
+
+class Scheduler {
+  SchedulerParams params;
+  std::mutex configMutex;
+  std::atomic<bool> started;
+  std::atomic<bool> stopping;
+  std::vector<std::thread> workers;
+  // [worker queues..., queue for outside threads]
+  std::unique_ptr<SchedulerTaskQueue[]> queues;
+  int numQueues;
+  std::atomic<int> numQueued;
+  // Incremented on every submit, wakes waiting groups.
+  std::atomic<unsigned> numSubmitted;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  // Threads waiting for group with no task to help with.
+  std::condition_variable idle;
+
+  void Start() {
+    std::lock_guard<std::mutex> guard(configMutex);
+
+    if (started)
+      return;
+
+    const int numWorkers = NumThreads() - 1;
+    numQueues = numWorkers + 1;
+    queues.reset(new SchedulerTaskQueue[numQueues]);
+    stopping = false;
+
+    for (int w = 0; w < numWorkers; w++) {
+      workers.emplace_back(&Scheduler::WorkerLoop, this, w);
+      SetWorkerAffinity(workers.back(), params.affinityMask, w);
+    }
+
+    started = true;
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> guard(sleepMutex);
+      stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (auto &w : workers)
+      w.join();
+
+    workers.clear();
+    started = false;
+  }
+
+  void WorkerLoop(int worker) {
+    workerIndex = worker;
+
+    while (!stopping) {
+      if (TryRunTask(nullptr))
+        continue;
+
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this]() { return stopping || numQueued > 0; });
+    }
+
+    workerIndex = -1;
+  }
+
+  bool AcquireTask(SchedulerTask &task, const SchedulerTaskGroup *group) {
+    const int outsideQueue = numQueues - 1;
+
+    if (workerIndex >= 0 && queues[workerIndex].Pop(task, group))
+      return true;
+
+    if (queues[outsideQueue].Steal(task, group))
+      return true;
+
+    const int first = workerIndex >= 0 ? workerIndex + 1 : 0;
+
+    for (int q = 0; q < outsideQueue; q++) {
+      const int victim = (first + q) % outsideQueue;
+
+      if (victim != workerIndex && queues[victim].Steal(task, group))
+        return true;
+    }
+
+    return false;
+  }
+
+public:
+  Scheduler() : params(), started(false), stopping(false), numQueues(0),
+                numQueued(0), numSubmitted(0) {}
+  ~Scheduler() { Stop(); }
+
+  void Configure(SchedulerParams newParams) {
+    Stop();
+    std::lock_guard<std::mutex> guard(configMutex);
+    params = newParams;
+  }
+
+  SchedulerParams GetParams() const { return params; }
+
+  int NumThreads() const {
+    if (params.numThreads > 0)
+      return params.numThreads;
+
+    const int numCores = static_cast<int>(std::thread::hardware_concurrency());
+
+    return numCores > 0 ? numCores : 1;
+  }
+
+  void Submit(SchedulerTask &&task) {
+    if (!started)
+      Start();
+
+    queues[workerIndex >= 0 ? workerIndex : numQueues - 1].Push(
+        std::move(task));
+
+    {
+      std::lock_guard<std::mutex> guard(sleepMutex);
+      numQueued++;
+      numSubmitted++;
+    }
+
+    wake.notify_one();
+    idle.notify_all();
+  }
+
+  // Executes one pending task within group, any task if group is nullptr.
+  // Returns false when there is none.
+  bool TryRunTask(const SchedulerTaskGroup *group) {
+    if (!started)
+      return false;
+
+    SchedulerTask task;
+
+    if (!AcquireTask(task, group))
+      return false;
+
+    numQueued--;
+    std::exception_ptr taskError;
+    SchedulerTaskGroup *lastGroup = currentGroup;
+    currentGroup = task.group;
+
+    try {
+      task.func();
+    } catch (...) {
+      taskError = std::current_exception();
+    }
+
+    currentGroup = lastGroup;
+
+    // Group might be gone once finished, only scheduler is touched after
+    if (task.group->Finish(taskError)) {
+      std::lock_guard<std::mutex> guard(sleepMutex);
+      idle.notify_all();
+    }
+
+    return true;
+  }
+
+  unsigned NumSubmitted() const { return numSubmitted; }
+
+  // Blocks until group finishes or new task is submitted after lastSubmitted.
+  void WaitIdle(const std::atomic<int> &numPending, unsigned lastSubmitted) {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idle.wait(lock, [&]() {
+      return numPending <= 0 || numSubmitted != lastSubmitted;
+    });
+  }
+};
+
+static Scheduler &GetScheduler() {
+  static Scheduler scheduler;
+  return scheduler;
+}
+
+void ConfigureScheduler(SchedulerParams params) {
+  GetScheduler().Configure(params);
+}
+
+SchedulerParams GetSchedulerParams() { return GetScheduler().GetParams(); }
+
+int SchedulerNumThreads() { return GetScheduler().NumThreads(); }
+
+SchedulerTaskGroup::SchedulerTaskGroup()
+    : numPending(0), parent(currentGroup) {}
+
+bool SchedulerTaskGroup::Finish(std::exception_ptr taskError) {
+  if (taskError) {
+    std::lock_guard<std::mutex> guard(errorMutex);
+
+    if (!error)
+      error = taskError;
+  }
+
+  return --numPending == 0;
+}
+
+bool SchedulerTaskGroup::IsWithin(const SchedulerTaskGroup *group) const {
+  for (const SchedulerTaskGroup *g = this; g; g = g->parent)
+    if (g == group)
+      return true;
+
+  return false;
+}
+
+// Helps with own tasks, sleeps when there is none left to take.
+void SchedulerTaskGroup::Join() {
+  Scheduler &scheduler = GetScheduler();
+
+  while (numPending > 0) {
+    const unsigned lastSubmitted = scheduler.NumSubmitted();
+
+    if (!scheduler.TryRunTask(this))
+      scheduler.WaitIdle(numPending, lastSubmitted);
+  }
+}
+
+void SchedulerTaskGroup::Run(std::function<void()> task) {
+  numPending++;
+
+  SchedulerTask cTask;
+  cTask.func = std::move(task);
+  cTask.group = this;
+
+  GetScheduler().Submit(std::move(cTask));
+}
+
+void SchedulerTaskGroup::Wait() {
+  Join();
+
+  std::exception_ptr taskError;
+
+  {
+    std::lock_guard<std::mutex> guard(errorMutex);
+    taskError = error;
+    error = nullptr;
+  }
+
+  if (taskError)
+    std::rethrow_exception(taskError);
+}
+
+SchedulerTaskGroup::~SchedulerTaskGroup() { Join(); }